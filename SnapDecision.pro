@@ -28,6 +28,7 @@ SOURCES += \
         src/decision.cpp \
         src/dnn.cpp \
         src/enums.cpp \
+        src/filefingerprint.cpp \
         src/imagedescriptionnode.cpp \
         src/imagegroup.cpp \
         src/imagetreemodel.cpp \
@@ -51,6 +52,7 @@ HEADERS += \
         include/snapdecision/decision.h \
         include/snapdecision/dnn.h \
         include/snapdecision/enums.h \
+        include/snapdecision/filefingerprint.h \
         include/snapdecision/imagedescriptionnode.h \
         include/snapdecision/imagegroup.h \
         include/snapdecision/imagetreemodel.h \
@@ -313,6 +313,12 @@ public:
     uint32_t MicroVideoVersion;     // just regularinfo
     uint32_t MicroVideoOffset;      // offset from end of file
   } MicroVideo;
+  struct TINYEXIF_LIB Thumbnail_t {       // Embedded JPEG thumbnail (IFD1)
+    uint32_t Offset;                // offset of the JPEG data from the start of the parsed stream
+                                    // (from the "Exif\0\0" bytes when calling parseFromEXIFSegment directly)
+    uint32_t Length;                // length of the JPEG data, 0 if there is no thumbnail
+    bool hasThumbnail() const;      // Return true if an embedded thumbnail is available
+  } Thumbnail;
 };
 
 } // namespace TinyEXIF
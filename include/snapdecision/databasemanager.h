@@ -2,11 +2,75 @@
 
 #include <QDebug>
 #include <QtSql>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "snapdecision/decision.h"
 #include "snapdecision/diagnostics.h"
+#include "snapdecision/filefingerprint.h"
+
+// Everything ingest learns about an image, written as one row. The decision is
+// deliberately not part of it so re-reading EXIF data never overwrites a vote.
+struct ImageRecord
+{
+  std::string absolute_path;
+
+  std::string make;
+  std::string model;
+  std::string date_time;
+  std::string date_time_original;
+  std::string sub_sec_time_original;
+
+  int image_width{ 0 };
+  int image_height{ 0 };
+  int bits_per_sample{ 0 };
+  int iso_speed_ratings{ 0 };
+  int orientation{ 0 };
+
+  double f_number{ 0 };
+  double exposure_time{ 0 };
+  double aperture_value{ 0 };
+  double brightness_value{ 0 };
+  double exposure_bias_value{ 0 };
+  double subject_distance{ 0 };
+  double focal_length{ 0 };
+
+  ExposureProgram exposure_program{ ExposureProgram::NotDefined };
+  MeteringMode metering_mode{ MeteringMode::Unknown };
+
+  std::size_t creation_ms{ 0 };
+
+  FileFingerprint fingerprint;  // of the file the EXIF data was read from
+};
+
+// A row as read back by the bulk load, together with the vote cast on it.
+struct StoredImage
+{
+  ImageRecord record;
+  DecisionType decision{ DecisionType::Unclassified };
+};
+
+using StoredImages = std::unordered_map<std::string, StoredImage>;
+
+// What DatabaseManager::findImages() matches, a field left unset matches everything.
+struct ImageQuery
+{
+  std::optional<DecisionType> decision{};
+  std::optional<int> min_iso{};  // inclusive
+  std::optional<int> max_iso{};  // inclusive
+  std::optional<std::string> make{};
+};
+
+// a column of image_data together with its value type, defined next to the schema
+template <typename T>
+struct DatabaseColumn;
 
 class DatabaseManager
 {
@@ -15,11 +79,16 @@ public:
   using WeakPtr = std::weak_ptr<DatabaseManager>;
 
   DatabaseManager(DiagnosticFunction diagnostic_function);
+  ~DatabaseManager();
 
   void checkpoint();
 
-  void switchToInMemory();
-  void switchToFileBased(const std::string& filePath);
+  using ProgressFunction = std::function<void(double)>;  // fraction done, 0 to 1
+
+  // Copies the current rows into the new database and makes it the current one. The copy runs
+  // inside SQLite in chunks, progress is reported after each of them. Safe to call off the GUI thread.
+  void switchToInMemory(const ProgressFunction& progress = {});
+  void switchToFileBased(const std::string& filePath, const ProgressFunction& progress = {});
   std::string getLocation() const;
 
   void setMake(const std::string& image_path, const std::string& make);
@@ -41,11 +110,35 @@ public:
   void setOrientation(const std::string& image_path, int value);
 
   void setDecision(const std::string& image_path, DecisionType decision);
+
+  // Hands the vote to the writer thread and returns straight away. Repeated votes on an image
+  // are coalesced and written in groups, reads, switching databases and close() see them.
+  void queueDecision(const std::string& image_path, DecisionType decision);
+
+  // Same for what ingest learned about an image, the writer commits a group of them with upsertRecords.
+  void queueRecord(ImageRecord record);
+  void flush();  // writes the queued votes and records now
   void setExposureProgram(const std::string& image_path, ExposureProgram exposureProgram);
   void setMeteringMode(const std::string& image_path, MeteringMode meteringMode);
 
   void setCreationMs(const std::string& image_path, std::size_t creation_ms);
 
+  // Inserts or updates every column of the record in a single statement, a batch
+  // shares one prepared statement and one transaction.
+  bool upsertRecord(const ImageRecord& record);
+  bool upsertRecords(std::span<const ImageRecord> records);
+
+  // Reads every row in one forward-only scan, keyed by absolute path. Opening a folder
+  // uses this instead of querying each column of each image separately.
+  StoredImages loadAllRecords();
+
+  // Only the rows of the directories the images are in, each directory read as a range of the key.
+  // Keeps opening a folder cheap when the database is a catalog of every folder.
+  StoredImages loadRecordsFor(const std::vector<std::string>& image_paths);
+
+  // Absolute paths of every image in the database matching the query, across all its directories.
+  std::vector<std::string> findImages(const ImageQuery& filter);
+
   std::optional<std::string> getMake(const std::string& image_path);
   std::optional<std::string> getModel(const std::string& image_path);
   std::optional<std::string> getDateTime(const std::string& image_path);
@@ -85,11 +178,90 @@ public:
 private:
   mutable std::recursive_mutex mutex_;
 
+  // Votes waiting for the writer thread, pushed without taking a lock, newest first.
+  struct PendingDecision
+  {
+    std::string image_path;
+    DecisionType decision;
+    PendingDecision* next{ nullptr };
+  };
+
+  std::atomic<PendingDecision*> pending_decisions_{ nullptr };
+  std::atomic<std::size_t> pending_decision_count_{ 0 };
+
+  struct PendingRecord
+  {
+    ImageRecord record;
+    PendingRecord* next{ nullptr };
+  };
+
+  std::atomic<PendingRecord*> pending_records_{ nullptr };
+  std::atomic<std::size_t> pending_record_count_{ 0 };
+
+  std::thread writer_thread_;
+  std::mutex writer_mutex_;  // only guards the writer's sleep
+  std::condition_variable writer_wake_;
+  std::atomic<bool> writer_stop_{ false };
+
+  void writerLoop();
+  void wakeWriter(std::size_t queued);  // with the count a queue has just reached
+  void writePending();  // votes and records
+  void writePendingDecisions();
+  void writePendingRecords();
+
+  // An open connection with what has been learned on it, both dropped when it closes.
+  struct Connection
+  {
+    std::shared_ptr<QSqlDatabase> database;
+    std::vector<std::unique_ptr<QSqlQuery>> statements;  // by slot, prepared on first use
+    std::unordered_map<std::string, qlonglong> directory_ids;  // directory table ids by path
+    std::size_t generation{ 0 };  // readers only, the writer database they were opened for
+  };
+
+  // The one connection that writes. Unlike the readers it is not tied to a thread: it is opened by
+  // whichever thread switches databases and used by any thread holding mutex_, the writer thread and
+  // the EXIF workers included. mutex_ makes sure only one of them is inside SQLite on it at a time.
+  Connection writer_;
+
+  // Read-only connections to the writer's file, one per thread, so reads don't queue behind mutex_ and
+  // run while the writer commits to the WAL. Each is opened, used and closed on its own thread, a thread
+  // closes its reader when the writer moves on or when the thread exits. An in-memory database only
+  // exists on the writer's connection and is read there.
+  struct Readers
+  {
+    std::mutex mutex;  // guards the map and the two fields below, not the connections
+    std::unordered_map<std::thread::id, std::unique_ptr<Connection>> connections;
+    QString location;  // empty while readers can't be used
+    std::size_t generation{ 0 };  // of the writer's database
+  };
+
+  // shared with the exit hooks of the threads that read, which may outlive the manager
+  std::shared_ptr<Readers> readers_{ std::make_shared<Readers>() };
+
+  Connection* readerConnection();  // the calling thread's, nullptr if reads have to go through writer_
+  template <typename Read>
+  auto withReader(Read read);
+
+  template <typename MakeSql>
+  QSqlQuery* statement(Connection& connection, std::size_t slot, MakeSql make_sql);
+  static void dropStatements(Connection& connection);
+
+  std::optional<qlonglong> directoryId(Connection& connection, const std::string& directory, bool create);
+
+  template <typename T>
+  bool setColumn(const DatabaseColumn<T>& column, const std::string& image_path, const T& value);
+  template <typename T>
+  std::optional<T> getColumn(const DatabaseColumn<T>& column, const std::string& image_path);
+
   DiagnosticFunction diagnostic_function_;
-  std::shared_ptr<QSqlDatabase> db;
 
   void initializeDb(QSqlDatabase& target);
-  std::shared_ptr<QSqlDatabase> createDb(const QString& db_name, const QString& connection = "");
-  void copyDataToNewDb(const QString& new_db_name);
-  void copyDbContents(QSqlDatabase& source_db, QSqlDatabase& target_db);
+  void migrateFromVersion1(QSqlDatabase& target);
+  void migrateFromVersion2(QSqlDatabase& target);
+  std::shared_ptr<QSqlDatabase> createDb(const QString& db_name);
+  void closeDb();
+  static void closeConnection(Connection& connection);
+  void openWriter(const std::shared_ptr<QSqlDatabase>& database);
+  void copyDataToNewDb(const QString& new_db_name, const ProgressFunction& progress);
+  bool copyRows(QSqlDatabase& host, const QString& from, const QString& to, const ProgressFunction& progress);
 };
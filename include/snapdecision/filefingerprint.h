@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QFileInfo>
+#include <QtGlobal>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Tells whether a file changed since it was ingested without parsing it again. The stat fields come from
+// the directory sweep, the hash is only computed when those disagree or a file is ingested.
+struct FileFingerprint
+{
+  qint64 size{ 0 };
+  qint64 modified_ms{ 0 };
+  qint64 inode{ 0 };         // the file's creation time where the file system has no inodes
+  qint64 partial_hash{ 0 };  // of the start and the end of the file, 0 while not computed
+
+  // same file, not written to since it was fingerprinted
+  bool sameStat(const FileFingerprint& other) const
+  {
+    return size == other.size && modified_ms == other.modified_ms && inode == other.inode;
+  }
+
+  // same contents as far as the hash can tell, e.g. a copied or touched file
+  bool sameContents(const FileFingerprint& other) const
+  {
+    return size == other.size && partial_hash != 0 && partial_hash == other.partial_hash;
+  }
+};
+
+struct FileStat
+{
+  FileFingerprint fingerprint;  // without the hash
+  std::size_t birth_ms{ 0 };
+};
+
+// by absolute path
+using FileStats = std::unordered_map<std::string, FileStat>;
+
+FileStat statFile(const QFileInfo& file_info);
+
+// Stats every file of the directories the images are in, one listing per directory.
+FileStats statDirectories(const std::vector<std::string>& image_paths);
+
+qint64 partialHash(const std::string& file_path);
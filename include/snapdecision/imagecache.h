@@ -2,10 +2,13 @@
 
 #include <QImage>
 #include <QObject>
-#include <QPixmap>
+#include <QSize>
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
+#include <future>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -20,6 +23,17 @@
 
 class ImageCache;
 
+// Each image can be resident at several resolutions, every tier has its own
+// memory budget and LRU.
+enum class ImageTier
+{
+  Thumbnail = 0,  // small preview
+  Screen,         // fits the screen, used for fit-to-view culling
+  Full            // full resolution, only needed when zoomed past fit
+};
+
+constexpr std::size_t image_tier_count = 3;
+
 class ImageCacheHandle
 {
 public:
@@ -36,31 +50,76 @@ public:
 
   ImageCacheHandle(std::weak_ptr<ImageCache> image_cache, const std::string& image_path);
 
-  QPixmap blockingImage();
-  QPixmap image();  // gets the image if it's available, otherwise a null QPixmal
-  void scheduleImage();
+  // Images come back display ready (RGB32 or ARGB32_Premultiplied), decoding never touches QPixmap so it is
+  // safe on any thread. Converting to a QPixmap is left to the GUI thread at display time.
+  QImage blockingImage(ImageTier tier = ImageTier::Full);
+  QImage blockingImage(const TaskHandle& task, ImageTier tier = ImageTier::Full);  // gives up early if cancelled
+  QImage image(ImageTier tier = ImageTier::Full);  // gets the image if it's available, otherwise a null QImage
+  // Returns the background load the request started or joined, nullptr if the tier is already there.
+  // Whoever asked can hand it back to withdraw() once the image is no longer wanted, the load is only
+  // cancelled when everyone who asked for it did.
+  std::shared_ptr<TaskHandle> scheduleImage(int priority = 0, ImageTier tier = ImageTier::Full);
+  void withdraw(ImageTier tier, const std::shared_ptr<TaskHandle>& load);
 
-  State getState() const;
-  void touch();
+  State getState(ImageTier tier = ImageTier::Full) const;
+  void touch(ImageTier tier = ImageTier::Full);  // must not be called while holding a tier mutex
 
   std::string imagePath() const;
   std::shared_ptr<ImageCache> cache() const;
 
-  std::size_t memory() const;
+  // size of the full resolution image, invalid until one of the tiers has been decoded
+  QSize fullSize() const;
+
+  // Location of the JPEG thumbnail embedded in the EXIF data, found while ingesting. The thumbnail
+  // tier decodes it instead of the whole file so something can be shown almost immediately.
+  void setEmbeddedPreview(std::uint32_t offset, std::uint32_t length, const QSize& full_size);
+  bool hasEmbeddedPreview() const;  // decoding the thumbnail tier only reads those few KB
+
+  std::size_t memory() const;  // all tiers
   std::size_t lastUsage() const;
-  void unload();
 
 private:
-  mutable std::recursive_mutex mutex_;
+  friend class ImageCache;
+
+  struct TierSlot
+  {
+    std::mutex mutex;  // held while this tier decodes
+    QImage image;
+    std::atomic<State> state{ State::Unloaded };
+    std::atomic<std::size_t> memory{ 0 };
+
+    std::shared_ptr<TaskHandle> task;  // guarded by task_mutex_
+
+    // position in the tier's LRU, guarded by ImageCache::cache_mutex_
+    std::list<ImageCacheHandle*>::iterator lru_position;
+    bool in_lru{ false };
+  };
+
+  TierSlot& slot(ImageTier tier);
+  const TierSlot& slot(ImageTier tier) const;
+
+  QImage load(ImageTier tier, const TaskHandle* task);
+  QImage deriveFromLargerTier(ImageTier tier, const QSize& target);
+  QImage loadEmbeddedPreview(const QSize& target);
+  void attachTask(ImageTier tier, const std::shared_ptr<TaskHandle>& task);
+  std::size_t unload(ImageTier tier);  // returns the bytes released
 
   std::weak_ptr<ImageCache> image_cache_;
 
-  std::atomic<State> state_{ State::Unloaded };
+  std::array<TierSlot, image_tier_count> tiers_;
+
+  // separate from the tier mutexes so a load can be cancelled while it is decoding
+  std::mutex task_mutex_;
 
-  QPixmap pixmap_;
   std::string image_path_;
-  std::size_t last_touch_{ 0 };
-  std::size_t memory_{ 0 };
+  std::atomic<std::size_t> last_touch_{ 0 };
+  std::atomic<int> full_width_{ 0 };
+  std::atomic<int> full_height_{ 0 };
+
+  // written by ingest, or by the first thumbnail load if ingest never saw the EXIF data
+  std::atomic<bool> preview_known_{ false };
+  std::atomic<std::uint32_t> preview_offset_{ 0 };
+  std::atomic<std::uint32_t> preview_length_{ 0 };
 };
 
 namespace ImageCacheSupport
@@ -76,10 +135,12 @@ public:
 
   void emitMemoryUsageChanged(CurrentMaxCount cmc);
   void emitHitMissUpdate(CountPair cp);
+  void emitImageLoaded(const std::string& image_path, ImageTier tier);
 
 signals:
   void memoryUsageChanged(CurrentMaxCount);
   void hitMissUpdate(CountPair);
+  void imageLoaded(QString image_path, int tier);
 };
 }  // namespace ImageCacheSupport
 
@@ -97,14 +158,36 @@ public:
   }
 
   ImageCacheHandle::Ptr getHandle(const std::string& image_path);
-  ImageCacheHandle::Ptr getImage(const std::string& image_path);
-  ImageCacheHandle::Ptr immediateGetImage(const std::string& image_path);
-  ImageCacheHandle::Ptr scheduleImage(const std::string& image_path);
+  ImageCacheHandle::Ptr getImage(const std::string& image_path, ImageTier tier = ImageTier::Full);
+  ImageCacheHandle::Ptr immediateGetImage(const std::string& image_path, ImageTier tier = ImageTier::Full);
+  ImageCacheHandle::Ptr scheduleImage(const std::string& image_path, int priority = 0,
+                                      ImageTier tier = ImageTier::Full);
+
+  // Starts a background load, or joins the one already queued or decoding for
+  // this path and tier. The future yields a null QImage if the load gets cancelled.
+  std::shared_future<QImage> requestImage(const std::string& image_path, int priority = 0,
+                                           ImageTier tier = ImageTier::Full);
 
-  CurrentMaxCount getMemoryUsage() const;
+  // number of requests that joined a pending load instead of decoding again
+  std::size_t coalescedLoadCount() const;
+
+  // running average of how long decoding a file takes for the tier, 0 until something was decoded
+  std::size_t averageDecodeTimeUs(ImageTier tier) const;
+
+  // Counts whether an image was already decoded when it was asked for, reported through hitMissUpdate.
+  void updateHitMiss(std::size_t hit_inc, std::size_t miss_inc);
+
+  CurrentMaxCount getMemoryUsage() const;  // summed over all tiers
+  CurrentMaxCount getMemoryUsage(ImageTier tier) const;
   std::size_t totalMemoryUsage() const;
 
+  // Splits the budget between the tiers, most of it going to screen sized images.
   void setMaxMemoryUsage(std::size_t max_memory_usage);
+  void setMaxMemoryUsage(ImageTier tier, std::size_t max_memory_usage);
+
+  // Largest size an image is decoded at for the tier, an invalid size means no limit.
+  void setTierSize(ImageTier tier, const QSize& size);
+  QSize tierSize(ImageTier tier) const;
 
   static DiagnosticFunction getDiagFunction(const ImageCache::WeakPtr& wp);
 
@@ -115,16 +198,50 @@ public:
   ImageCacheSupport::SignalEmitter signal_emitter;
 
 private:
+  friend class ImageCacheHandle;
+
+  struct PendingLoad
+  {
+    std::shared_ptr<TaskHandle> task;
+    std::shared_future<QImage> result;
+    std::size_t requesters{ 1 };  // that haven't withdrawn their request
+  };
+
+  struct TierCache
+  {
+    // loaded handles, most recently used at the front
+    std::list<ImageCacheHandle*> lru;
+    std::atomic<std::size_t> memory_usage{ 0 };
+    std::atomic<std::size_t> loaded_count{ 0 };
+    std::atomic<std::size_t> max_memory_usage{ 0 };  // bytes
+    std::atomic<std::size_t> average_decode_us{ 0 };
+    QSize target_size;
+
+    // one entry per path with a background load in flight
+    std::unordered_map<std::string, PendingLoad> pending_loads;
+  };
+
+  TierCache& tierCache(ImageTier tier);
+  const TierCache& tierCache(ImageTier tier) const;
+
   std::unordered_map<std::string, ImageCacheHandle::Ptr> cache_;
+  std::array<TierCache, image_tier_count> tiers_;
+  std::size_t next_reclaim_size_{ 1024 };
+  std::atomic<std::size_t> coalesced_count_{ 0 };
 
-  std::atomic<size_t> max_memory_usage_{ 1000 * 1000 * 1000 };  // bytes
   mutable std::recursive_mutex cache_mutex_;
 
   DiagnosticFunction diag_func_;
   TaskQueue::Ptr task_queue_;
 
-  void blockingLoadToCache(const std::string& image_path);
-  void updateHitMiss(std::size_t hit_inc, std::size_t miss_inc);
+  QImage blockingLoadToCache(const std::string& image_path, ImageTier tier, const TaskHandle* task = nullptr);
+  PendingLoad& pendingLoad(const std::string& image_path, int priority, ImageTier tier);  // cache_mutex_ held
+  bool withdrawRequest(const std::string& image_path, ImageTier tier, const TaskHandle* task);  // true if last
+  void finishPendingLoad(const std::string& image_path, ImageTier tier, const TaskHandle* task);
+  void onLoaded(ImageCacheHandle* handle, ImageTier tier);
+  void touch(ImageCacheHandle* handle, ImageTier tier);
+  void reclaimHandles();
+  void recordDecodeTime(ImageTier tier, std::size_t us);
 
   std::size_t hit_count_{ 0 };
   std::size_t miss_count_{ 0 };
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <array>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "snapdecision/databasemanager.h"
@@ -17,6 +20,50 @@ enum class NodeType
   Image
 };
 
+// How many images have each decision, indexed by DecisionType.
+struct DecisionCounts
+{
+  std::array<int, 5> counts{};
+
+  int operator[](DecisionType d) const
+  {
+    return counts[static_cast<std::size_t>(d)];
+  }
+
+  void add(DecisionType d, int delta)
+  {
+    counts[static_cast<std::size_t>(d)] += delta;
+  }
+
+  int total() const
+  {
+    int sum = 0;
+    for (const int c : counts)
+    {
+      sum += c;
+    }
+    return sum;
+  }
+
+  DecisionCounts& operator+=(const DecisionCounts& other)
+  {
+    for (std::size_t i = 0; i < counts.size(); i++)
+    {
+      counts[i] += other.counts[i];
+    }
+    return *this;
+  }
+
+  DecisionCounts& operator-=(const DecisionCounts& other)
+  {
+    for (std::size_t i = 0; i < counts.size(); i++)
+    {
+      counts[i] -= other.counts[i];
+    }
+    return *this;
+  }
+};
+
 struct ImageDescriptionNode
 {
   ImageDescriptionNode(NodeType type = NodeType::Image);
@@ -39,6 +86,14 @@ struct ImageDescriptionNode
   DecisionType decision{ DecisionType::Unclassified };
   ExposureProgram exposure_program{ ExposureProgram::NotDefined };
 
+  // Decisions of the images in this subtree, an image counts itself. Filled in when the tree is
+  // built and kept current by setDecision().
+  DecisionCounts decision_counts;
+
+  // Changes an image's decision and applies the difference to its own tallies and those of every
+  // node above it. Returns false if the decision was already d.
+  bool setDecision(DecisionType d);
+
   template <typename C, typename T = typename std::invoke_result_t<C, ImageDescriptionNode*>>
   std::optional<T> leafConsensus(C callable)
   {
@@ -162,7 +217,42 @@ struct ImageDescriptionNode
   std::atomic<bool> ready{ false };
 };
 
+// Replaces count of parent's children from row on with replacement and points the replacement's nodes
+// at their new parents. Streaming images into a tree edits it this way only.
+void replaceChildren(const ImageDescriptionNode::Ptr& parent, int row, int count,
+                     const std::vector<ImageDescriptionNode::Ptr>& replacement);
+
+using ReplaceChildren = std::function<void(const ImageDescriptionNode::Ptr& parent, int row, int count,
+                                           const std::vector<ImageDescriptionNode::Ptr>& replacement)>;
+
+// the per-folder database the votes and EXIF data of the folder's images are kept in
+std::string folderDatabasePath(const std::string& directory);
+
+// The files of the swept directories grouped into frames by directory and base name, so pairing an image
+// with its RAW file is a lookup instead of probing the file system for every RAW extension.
+class SiblingIndex
+{
+public:
+  SiblingIndex() = default;
+  explicit SiblingIndex(const FileStats& file_stats);
+
+  std::string rawFor(const std::string& image_path) const;  // empty if the frame has no RAW file
+
+  // RAW files of frames without anything else, nothing shows them
+  std::vector<std::string> rawOnly() const;
+
+private:
+  std::unordered_map<std::string, std::vector<std::string>> frames_;
+};
+
+// called once a node's time is known, with nullptr for a file that is no image
+using NodeFunction = std::function<void(const ImageDescriptionNode::Ptr& node)>;
+
+// Rows in stored_images whose fingerprint matches the file's stat in file_stats are filled in directly,
+// everything else gets its EXIF data read on the task queue at the given priority.
 ImageDescriptionNode::Ptr buildImageDescriptionNode(const std::string& filename, const ImageCache::Ptr& image_cache,
                                                     const TaskQueue::Ptr& task_queue,
                                                     const DatabaseManager::Ptr& database_manager,
-                                                    const SimpleFunction& on_finish);
+                                                    const StoredImages& stored_images, const FileStats& file_stats,
+                                                    const SiblingIndex& siblings, const NodeFunction& on_ready,
+                                                    int priority = 0);
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <QFileSystemWatcher>
 #include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "snapdecision/imagecache.h"
@@ -21,9 +27,13 @@ public:
 
   ImageGroup();
 
-  void loadFiles(const std::vector<std::string>& filenames, const ImageCache::Ptr& image_cache,
-                 const TaskQueue::Ptr& task_queue, const DatabaseManager::Ptr& database_manager,
-                 const DiagnosticFunction& diagnostic_function);
+  // Indexes the images matching name_filters in the folder and all folders below it in the background.
+  // The tree starts out empty, treeCleared(), and images are put into it as their times become known,
+  // treeUpdated(). The folders are watched from then on, images copied into them, changed or removed are
+  // put into or taken out of the tree.
+  void loadFolder(const QString& directory, const QStringList& name_filters, const ImageCache::Ptr& image_cache,
+                  const TaskQueue::Ptr& task_queue, const DatabaseManager::Ptr& database_manager,
+                  const DiagnosticFunction& diagnostic_function);
 
   ImageDescriptionNode::Ptr getNodeAtIndex(int index) const;
 
@@ -38,15 +48,124 @@ public:
 
   bool remove(const std::string& full_path);
 
+  // tallies of the whole tree, as of the last build plus every vote since
+  DecisionCounts decisionCounts() const;
+
+  // How images are put into and taken out of tree_root_ as they arrive, set to tell a model showing the tree.
+  ReplaceChildren replace_children_{ replaceChildren };
+
 signals:
   void fileListLoadComplete();
   void treeBuildComplete();
+  void treeCleared();
+  void treeUpdated();
+  void databaseOpenProgress(double fraction);
+  void nodesReady();
+  void watchedDirectoryChanged(const QString& directory);
+  void directoriesFound(const QStringList& directories);
 
 public slots:
-  void onFileListLoadComplete();
+  void onFileListLoadComplete();  // builds the tree from scratch
+  void onNodesReady();
 
 private:
   void adjustWorkLeft(int delta_work);
+  void queueReadyNode(int generation, const ImageDescriptionNode::Ptr& node);
+  void queueGonePath(int generation, const std::string& full_path);
+  void forgetDirectory(int generation, const std::string& directory);  // and all below it, switch mutex held
+  void updateTree(std::vector<ImageDescriptionNode::Ptr> added, const std::vector<ImageDescriptionNode::Ptr>& removed);
+
+  // Put one image into or take it out of the tree, between the images shown before and after it in time.
+  // Only the rows around it change, as they would if the tree was built again.
+  void insertIntoTree(const ImageDescriptionNode::Ptr& image, const ImageDescriptionNode::Ptr& before,
+                      const ImageDescriptionNode::Ptr& after, const Settings& settings);
+  void removeFromTree(const ImageDescriptionNode::Ptr& image, const ImageDescriptionNode::Ptr& before,
+                      const ImageDescriptionNode::Ptr& after, const Settings& settings);
+
+  // The images of one directory being handed out, shared by the tasks building their nodes.
+  struct Ingest
+  {
+    int generation{ 0 };
+    std::vector<std::string> filenames;
+    StoredImages stored_images;
+    FileStats file_stats;
+    SiblingIndex siblings;
+    std::vector<ImageDescriptionNode::Ptr> nodes;  // by position in filenames, keeps them while EXIF is read
+    std::atomic<std::size_t> nodes_left{ 0 };      // until every node's time is known
+  };
+
+  std::vector<std::shared_ptr<Ingest>> ingests_;  // guarded by load_mutex_, those in flight
+
+  // Nodes whose time is known and paths of images that left the folder, waiting for onNodesReady() to
+  // update the tree. Guarded by load_mutex_, a single queued call takes whatever arrived until the GUI
+  // thread gets to it.
+  std::vector<ImageDescriptionNode::Ptr> ready_nodes_;
+  std::vector<std::string> gone_paths_;
+
+  // What each directory held when it was last looked at, guarded by database_switch_mutex_.
+  struct WatchedFile
+  {
+    FileFingerprint fingerprint;
+    std::string raw_path;
+  };
+  struct PendingFile
+  {
+    WatchedFile file;
+    qint64 seen_ms{ 0 };  // when a sweep first found it looking like this
+  };
+  struct WatchedDirectory
+  {
+    std::unordered_map<std::string, WatchedFile> files;
+    std::unordered_map<std::string, PendingFile> pending;  // new or changed, not ingested until they settle
+    std::set<std::string> subdirectories;
+  };
+  std::unordered_map<std::string, WatchedDirectory> watched_directories_;  // by absolute path
+  int watched_generation_{ 0 };  // the load watched_directories_ was filled in by
+
+  // What ingesting from the watched folders takes.
+  struct Watch
+  {
+    QStringList name_filters;
+    QString excluded_name;  // of the folders marked images are moved to
+    ImageCache::Ptr image_cache;
+    TaskQueue::Ptr task_queue;
+    DatabaseManager::Ptr database_manager;
+    DiagnosticFunction diagnostic_function;
+  };
+  Watch watch_;  // GUI thread only
+
+  // Directories are visited one after the other and their images handed to the task queue in chunks, but
+  // only while fewer than a bounded number wait for their time. Whoever brings it back down resumes the
+  // walk, so the queue holds about the same no matter how many images the folders hold.
+  struct Walk
+  {
+    int generation{ 0 };
+    Watch watch;
+    std::vector<std::string> directories;  // still to visit, the next at the back
+    std::shared_ptr<Ingest> current;       // of the directory being handed out
+    std::size_t next{ 0 };                 // first image of current not handed out yet
+    bool settle{ false };                  // hold back files still being written, off for the first load
+
+    std::mutex mutex;  // guards the three below
+    std::size_t in_flight{ 0 };
+    bool producing{ false };  // a step of the walk is queued or running
+    bool finished{ false };
+  };
+
+  void continueWalk(const std::shared_ptr<Walk>& walk);  // with database_switch_mutex_ held
+  void finishWalk(const std::shared_ptr<Walk>& walk);
+  void imageDone(const std::shared_ptr<Walk>& walk);
+  std::shared_ptr<Ingest> visitDirectory(Walk& walk, const std::string& directory);
+
+  QFileSystemWatcher watcher_;
+  QTimer sweep_timer_;  // events come in bursts while a card is copied, one sweep follows each burst
+  std::set<QString> changed_directories_;  // GUI thread only, what the next sweep visits
+
+  void sweepWatchedFolder();
+
+  std::mutex load_mutex_;
+  std::mutex database_switch_mutex_;       // one switch at a time
+  std::atomic<int> load_generation_{ 0 };  // a newer loadFolder() supersedes the pending one
 
   std::map<std::string, ImageDescriptionNode::Ptr> map_;
 
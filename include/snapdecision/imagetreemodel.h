@@ -27,6 +27,10 @@ public:
   // Setter method for ImageDescriptions
   void setImageRoot(const ImageDescriptionNode::Ptr& root_node);
 
+  // Edits the tree as replaceChildren() does, as removed and inserted rows so views keep everything else.
+  void replaceChildren(const ImageDescriptionNode::Ptr& parent, int row, int count,
+                       const std::vector<ImageDescriptionNode::Ptr>& replacement);
+
   Qt::ItemFlags flags(const QModelIndex& index) const override;
 
   ImageDescriptionNode* nodeFromIndex(const QModelIndex& index) const;
@@ -37,9 +41,13 @@ public:
 
 private:
   void recomputeCachedData();
+  void rememberImages(ImageDescriptionNode* node);
+  void forgetImages(ImageDescriptionNode* node);
+  QModelIndex indexForNode(ImageDescriptionNode* node) const;
+  bool isShown(ImageDescriptionNode* node) const;
 
-  QVector<QString> file_list_;
-  QMap<QString, QModelIndex> index_for_image_;
+  // by path, rows move as images stream in so their indices are looked up when asked for
+  QMap<QString, ImageDescriptionNode*> node_for_image_;
 
   ImageDescriptionNode* nodeFromIndex(const QModelIndex& index, ImageDescriptionNode* fallback) const;
   ImageDescriptionNode::Ptr root_;
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <QKeyEvent>
+#include <QPersistentModelIndex>
 #include <QTreeView>
+#include <vector>
 
 #include "snapdecision/types.h"
 
@@ -21,15 +23,21 @@ public:
 public slots:
   void setDecisionVisible(DecisionType d, bool visible);
   void updateHides();
+  void showArrivedRows();  // expands and filters only the rows inserted since the last call
 
 protected:
   QModelIndex getLastIndex() const;
   void keyPressEvent(QKeyEvent* event) override;
+  void rowsInserted(const QModelIndex& parent, int start, int end) override;
   void iterateChildHide(const QModelIndex &parent, ImageTreeModel* model);
+  void updateHide(const QModelIndex& index, ImageTreeModel* model);  // and everything below it
+  bool rowVisible(const QModelIndex& index, ImageTreeModel* model) const;
 
   bool isVisible(DecisionType decision_type) const;
 
   bool keep_visible_{ true };
   bool unclassified_visible_{ true };
   bool delete_visible_{ true };
+
+  std::vector<QPersistentModelIndex> arrived_rows_;
 };
@@ -1,7 +1,17 @@
 #pragma once
 
 #include <QImage>
+#include <QSize>
 #include <QString>
+#include <cstddef>
 
+// Decodes at the smallest libjpeg-turbo scale that still covers target (keeping the
+// aspect ratio), an invalid target decodes at full resolution. full_size receives
+// the dimensions of the undecoded image.
+QImage libjpegturboOpen(const QString& filename, QSize target = QSize(), QSize* full_size = nullptr);
 
-QImage libjpegturboOpen(const QString& filename);
+// Decodes a JPEG stored inside another file, such as the thumbnail embedded in the EXIF data.
+QImage libjpegturboOpenEmbedded(const QString& filename, qint64 offset, qint64 length, QSize target = QSize());
+
+// Decoded pixel buffers no longer used are kept for the next decode, up to this many bytes in all.
+void libjpegturboSetBufferPoolLimit(std::size_t bytes);
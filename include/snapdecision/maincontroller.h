@@ -1,6 +1,9 @@
 #pragma once
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <optional>
+#include <utility>
 
 #include "mainmodel.h"
 #include "mainwindow.h"
@@ -18,15 +21,21 @@ public:
 
 public slots:  // Slot declaration
   void treeBuildComplete();
+  void treeCleared();
+  void treeUpdated();
   void loadResource(const QString& path);
   void focusOnNode(const QString& image_name);
   void memoryUsageChanged(CurrentMaxCount cmc);
+  void hitMissUpdate(CountPair cp);
+  void imageLoaded(const QString& image_path, int tier);
+  void fullResolutionNeeded();
   void updateDecisionCounts();
   void moveDeleteMarked();
 
 private:
   void executeTool(int i);
   void removeAllDecisions();
+  void copyGoldPaths();
 
   void voteAdjust(const ImageDescriptionNode::Ptr& ptr, int direction);
   void voteSet(const ImageDescriptionNode::Ptr& ptr, DecisionType decision);
@@ -45,9 +54,35 @@ private:
   int previous_focus_index_{ -1 };
   int current_focus_index_{ -1 };
   QString resource_;
+  QString pending_focus_;  // the image asked for while a load streams in, until it has arrived
   QString current_image_full_path_;
+  std::optional<ImageTier> displayed_tier_;  // empty until some tier of the current image is on screen
+
+  // Loads this controller asked for, the only ones it may take back. Other requesters of the same
+  // load keep it going.
+  struct OwnedLoad
+  {
+    ImageCacheHandle::Ptr handle;
+    ImageTier tier;
+    std::shared_ptr<TaskHandle> load;
+  };
+  std::vector<OwnedLoad> on_screen_loads_;  // for the image on screen
+  std::vector<OwnedLoad> prefetch_loads_;   // for images we expect to visit next
+
+  // how quickly we are moving through the images, drives the size of the prefetch window
+  QElapsedTimer navigation_timer_;
+  double navigation_interval_ms_{ 0 };
+
+  // how often the image was already decoded when we got to it
+  CountPair ready_count_{ 0, 0 };
 
   int predictNextNode(int step) const;
+  void updateNavigationRate();
+  std::pair<int, int> prefetchWindow() const;  // ahead, behind
+  void prefetch(const std::vector<ImageCacheHandle::Ptr>& wanted);
+  static void requestLoad(std::vector<OwnedLoad>& owned, const ImageCacheHandle::Ptr& handle, int priority,
+                          ImageTier tier);
+  static void withdrawLoads(const std::vector<OwnedLoad>& owned);
 
   void setupConnections();
 };
@@ -16,6 +16,13 @@ struct Settings
   std::size_t cache_memory_mb_{ 750 };
   bool show_debug_console_{ false };
 
+  // The number of images prefetched ahead adapts to how fast we navigate, up to this limit.
+  std::size_t prefetch_max_ahead_{ 8 };
+  std::size_t prefetch_behind_{ 1 };
+
+  // One database for every folder instead of a .image_database.db in each of them, empty for the latter.
+  QString catalog_database_path_;
+
   QKeySequence key_next_image_{ Qt::Key_Right };
   QKeySequence key_prev_image_{ Qt::Key_Left };
   QKeySequence key_keep_and_next_{ Qt::SHIFT | Qt::Key_Space };
@@ -18,7 +18,9 @@ class SnapDecisionGraphicsView : public QGraphicsView
 public:
   SnapDecisionGraphicsView(QWidget* parent = nullptr);
   ~SnapDecisionGraphicsView();
-  void setImage(const QPixmap& pixmap, const std::string& filename, int orientation);
+  // full_size is the resolution of the original image, a smaller pixmap is scaled up to it so the
+  // scene is always in full resolution coordinates and tiers can be swapped without moving the view
+  void setImage(const QPixmap& pixmap, const std::string& filename, int orientation, QSize full_size = QSize());
 
   keyEventFunction key_event_function_;
 
@@ -29,18 +31,22 @@ public:
 
   void setViewLevel(int i);
 
+  bool isZoomedPastFit();
+
   void pan(float dx, float dy);
   void panView(int dx, int dy);
 
   void storeCenter();
   void restoreCenter();
 
+signals:
+  void fullResolutionNeeded();
+
 public slots:
   void externalZoomIn();
 
   void externalZoomOut();
 
-
 protected:
   void wheelEvent(QWheelEvent* event) override;
 
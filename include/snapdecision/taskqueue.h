@@ -1,14 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
+#include <shared_mutex>
 #include <thread>
 #include <vector>
 
+class TaskQueue;
+
 class TaskHandle
 {
 public:
@@ -20,7 +25,8 @@ public:
     Cancelled
   };
 
-  TaskHandle(std::shared_ptr<double> progress_ptr) : progress_ptr_(progress_ptr), state_(TaskState::Queued)
+  TaskHandle(std::shared_ptr<double> progress_ptr, int priority = 0)
+    : progress_ptr_(progress_ptr), state_(TaskState::Queued), priority_(priority)
   {
   }
 
@@ -32,6 +38,24 @@ public:
   {
     return state_;
   }
+  int getPriority() const
+  {
+    return priority_;
+  }
+
+  // A queued task is dropped without running. A running task is only flagged,
+  // it has to poll isCancelled() to bail out early. Returns false if the task
+  // had already finished.
+  bool cancel();
+
+  bool isCancelled() const
+  {
+    return cancel_requested_;
+  }
+
+  // Moves a task that is still queued to its new place in the priority order.
+  // Returns false if the task has already been started, finished or cancelled.
+  bool reprioritize(int priority);
 
 private:
   friend class TaskQueue;
@@ -46,16 +70,35 @@ private:
     state_ = state;
   }
 
+  bool tryStart()
+  {
+    auto expected = TaskState::Queued;
+    return state_.compare_exchange_strong(expected, TaskState::Running);
+  }
+
   std::shared_ptr<double> progress_ptr_;
   std::atomic<TaskState> state_;
+  std::atomic<int> priority_;
+  std::atomic<bool> cancel_requested_{ false };
+  std::weak_ptr<TaskQueue> queue_;
 };
 
-class TaskQueue
+// Work-stealing thread pool. Each worker owns a deque of tasks ordered by
+// priority (highest first, FIFO within a priority). Tasks submitted from a
+// worker go to that worker's deque, tasks submitted from any other thread are
+// spread round-robin. A worker whose deque is empty steals the highest
+// priority task it can find from the other workers.
+class TaskQueue : public std::enable_shared_from_this<TaskQueue>
 {
 public:
   using Ptr = std::shared_ptr<TaskQueue>;
 
-  TaskQueue(size_t threadCount = 1) : shutdown_(false), shutdown_one_(false)
+  static std::size_t defaultThreadCount()
+  {
+    return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  }
+
+  TaskQueue(std::size_t threadCount = defaultThreadCount()) : shutdown_(false)
   {
     setThreadCount(threadCount);
   }
@@ -63,128 +106,352 @@ public:
   ~TaskQueue()
   {
     {
-      std::lock_guard<std::mutex> lock(task_queue_mutex_);
+      std::unique_lock lock(workers_mutex_);
       shutdown_ = true;
-      while (!tasks_.empty())
+      for (auto& worker : workers_)
       {
-        tasks_.pop();
+        std::lock_guard queue_lock(worker->mutex);
+        pending_ -= static_cast<long>(worker->tasks.size());
+        for (auto& task : worker->tasks)
+        {
+          task.handle->updateState(TaskHandle::TaskState::Cancelled);
+        }
+        worker->tasks.clear();
       }
     }
-    cond_.notify_all();
+    wakeAll();
 
-    joinFinishedThreads();  // Ensure all threads are joined on destruction
+    std::vector<std::unique_ptr<Worker>> workers;
+    {
+      std::unique_lock lock(workers_mutex_);
+      workers.swap(workers_);
+    }
 
-    for (std::thread& worker : workers_)
+    for (auto& worker : workers)
     {
-      if (worker.joinable())
+      if (worker->thread.joinable())
       {
-        worker.join();
+        worker->thread.join();
       }
     }
   }
 
-  void setThreadCount(size_t count)
+  // At least one worker is always kept so queued work can make progress.
+  void setThreadCount(std::size_t count)
   {
-    std::lock_guard lock(thread_management_mutex_);
-    if (count >= workers_.size())
+    std::lock_guard management_lock(thread_management_mutex_);
+
+    count = std::max<std::size_t>(count, 1);
+
+    std::vector<std::unique_ptr<Worker>> removed;
     {
-      for (size_t i = workers_.size(); i < count; ++i)
+      std::unique_lock lock(workers_mutex_);
+
+      for (std::size_t i = workers_.size(); i < count; ++i)
+      {
+        auto worker = std::make_unique<Worker>();
+        Worker* raw = worker.get();
+        workers_.push_back(std::move(worker));
+        raw->thread = std::thread([this, raw] { this->workerFunction(raw); });
+      }
+
+      while (workers_.size() > count)
+      {
+        workers_.back()->stop = true;
+        removed.push_back(std::move(workers_.back()));
+        workers_.pop_back();
+      }
+
+      // Anything a retired worker did not get to goes over to the survivors right away. Left behind until
+      // the join, it would count as pending where no one looks and keep the others spinning.
+      for (auto& worker : removed)
       {
-        workers_.emplace_back(std::thread([this] { this->workerFunction(); }));
+        std::lock_guard queue_lock(worker->mutex);
+        for (auto& task : worker->tasks)
+        {
+          Worker* target = workers_[next_worker_++ % workers_.size()].get();
+          std::lock_guard target_lock(target->mutex);
+          insertByPriority(target->tasks, std::move(task));
+        }
+        worker->tasks.clear();
       }
     }
-    else
+
+    if (removed.empty())
     {
-      size_t excess_threads = workers_.size() - count;
-      for (size_t i = 0; i < excess_threads; ++i)
+      return;
+    }
+
+    wakeAll();
+
+    for (auto& worker : removed)
+    {
+      if (worker->thread.joinable())
       {
-        shutdown_one_ = true;
-        cond_.notify_one();
-        threads_to_join_.push_back(std::move(workers_.back()));
-        workers_.pop_back();
+        worker->thread.join();
       }
     }
-    joinFinishedThreads();
+  }
+
+  std::size_t threadCount() const
+  {
+    std::shared_lock lock(workers_mutex_);
+    return workers_.size();
   }
 
   std::shared_ptr<TaskHandle> submit(std::function<void(double&)> func, int priority = 0)
+  {
+    return submit([func](double& progress, const TaskHandle&) { func(progress); }, priority);
+  }
+
+  // For long running work that wants to observe TaskHandle::isCancelled().
+  std::shared_ptr<TaskHandle> submit(std::function<void(double&, const TaskHandle&)> func, int priority = 0)
   {
     auto progress_ptr = std::make_shared<double>(0.0);
-    auto handle = std::make_shared<TaskHandle>(progress_ptr);
-    {
-      std::lock_guard<std::mutex> lock(task_queue_mutex_);
-      tasks_.emplace(priority,
-                     [func, handle, progress_ptr]()
-                     {
-                       handle->updateState(TaskHandle::TaskState::Running);
-                       func(*progress_ptr);
-                       handle->updateState(TaskHandle::TaskState::Completed);
-                     });
-    }
-    cond_.notify_one();
+    auto handle = std::make_shared<TaskHandle>(progress_ptr, priority);
+    handle->queue_ = weak_from_this();
+
+    enqueue(Task{ priority, handle, std::move(func) });
+
     return handle;
   }
 
 private:
-  void joinFinishedThreads()
+  friend class TaskHandle;
+
+  struct Task
+  {
+    int priority;
+    std::shared_ptr<TaskHandle> handle;
+    std::function<void(double&, const TaskHandle&)> func;
+  };
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+    std::atomic<bool> stop{ false };
+  };
+
+  // Set on each worker thread so submissions from inside a task stay local.
+  inline static thread_local const TaskQueue* current_queue_{ nullptr };
+  inline static thread_local Worker* current_worker_{ nullptr };
+
+  static void insertByPriority(std::deque<Task>& tasks, Task&& task)
+  {
+    const auto it = std::upper_bound(tasks.begin(), tasks.end(), task.priority,
+                                     [](int priority, const Task& t) { return priority > t.priority; });
+    tasks.insert(it, std::move(task));
+  }
+
+  void enqueue(Task&& task)
   {
-    std::lock_guard lock(thread_management_mutex_);
-    auto it = threads_to_join_.begin();
-    while (it != threads_to_join_.end())
     {
-      if (it->joinable())
+      std::shared_lock lock(workers_mutex_);
+
+      if (shutdown_ || workers_.empty())
+      {
+        task.handle->updateState(TaskHandle::TaskState::Cancelled);
+        return;
+      }
+
+      Worker* target = nullptr;
+      if (current_queue_ == this && current_worker_ && !current_worker_->stop)
       {
-        it->join();
-        it = threads_to_join_.erase(it);
+        target = current_worker_;
       }
       else
       {
-        ++it;
+        target = workers_[next_worker_++ % workers_.size()].get();
       }
+
+      std::lock_guard queue_lock(target->mutex);
+      insertByPriority(target->tasks, std::move(task));
     }
+
+    {
+      std::lock_guard lock(sleep_mutex_);
+      ++pending_;
+    }
+    cond_.notify_one();
   }
 
-  struct Task
+  // Removes a cancelled task from whichever deque holds it.
+  void discard(const TaskHandle* handle)
   {
-    int priority;
-    std::function<void()> func;
+    std::shared_lock lock(workers_mutex_);
+
+    for (const auto& worker : workers_)
+    {
+      std::lock_guard queue_lock(worker->mutex);
 
-    bool operator<(const Task& other) const
+      const auto it = std::find_if(worker->tasks.begin(), worker->tasks.end(),
+                                   [handle](const Task& t) { return t.handle.get() == handle; });
+      if (it != worker->tasks.end())
+      {
+        worker->tasks.erase(it);
+        --pending_;
+        return;
+      }
+    }
+  }
+
+  bool reprioritize(const TaskHandle* handle, int priority)
+  {
+    std::shared_lock lock(workers_mutex_);
+
+    for (const auto& worker : workers_)
     {
-      return priority < other.priority;
+      std::lock_guard queue_lock(worker->mutex);
+
+      const auto it = std::find_if(worker->tasks.begin(), worker->tasks.end(),
+                                   [handle](const Task& t) { return t.handle.get() == handle; });
+      if (it != worker->tasks.end())
+      {
+        Task task = std::move(*it);
+        worker->tasks.erase(it);
+        task.priority = priority;
+        insertByPriority(worker->tasks, std::move(task));
+        return true;
+      }
     }
-  };
+    return false;
+  }
 
-  std::priority_queue<Task> tasks_;
-  std::vector<std::thread> workers_;
-  std::vector<std::thread> threads_to_join_;
-  std::mutex task_queue_mutex_;
-  std::recursive_mutex thread_management_mutex_;
-  std::condition_variable cond_;
-  std::atomic<bool> shutdown_;
-  std::atomic<bool> shutdown_one_;
+  void wakeAll()
+  {
+    {
+      std::lock_guard lock(sleep_mutex_);
+    }
+    cond_.notify_all();
+  }
 
-  void workerFunction()
+  std::optional<Task> popOwn(Worker* self)
   {
-    while (true)
+    std::lock_guard queue_lock(self->mutex);
+    if (self->tasks.empty())
     {
-      std::function<void()> task;
+      return std::nullopt;
+    }
+    Task task = std::move(self->tasks.front());
+    self->tasks.pop_front();
+    return task;
+  }
+
+  std::optional<Task> steal(Worker* self)
+  {
+    std::shared_lock lock(workers_mutex_);
+
+    Worker* victim = nullptr;
+    int best_priority = 0;
+
+    for (const auto& worker : workers_)
+    {
+      if (worker.get() == self)
       {
-        std::unique_lock<std::mutex> lock(task_queue_mutex_);
-        cond_.wait(lock, [this] { return shutdown_ || shutdown_one_ || !tasks_.empty(); });
-        if (shutdown_one_)
-        {
-          shutdown_one_ = false;  // Reset the flag
-          return;                 // Exit the thread
-        }
-        if (shutdown_ && tasks_.empty())
+        continue;
+      }
+
+      std::lock_guard queue_lock(worker->mutex);
+      if (!worker->tasks.empty() && (!victim || worker->tasks.front().priority > best_priority))
+      {
+        victim = worker.get();
+        best_priority = worker->tasks.front().priority;
+      }
+    }
+
+    if (!victim)
+    {
+      return std::nullopt;
+    }
+
+    std::lock_guard queue_lock(victim->mutex);
+    if (victim->tasks.empty())
+    {
+      return std::nullopt;
+    }
+    Task task = std::move(victim->tasks.front());
+    victim->tasks.pop_front();
+    return task;
+  }
+
+  void workerFunction(Worker* self)
+  {
+    current_queue_ = this;
+    current_worker_ = self;
+
+    while (!self->stop)
+    {
+      std::optional<Task> task = popOwn(self);
+      if (!task)
+      {
+        task = steal(self);
+      }
+
+      if (task)
+      {
+        --pending_;
+
+        // a task cancelled while queued is simply dropped
+        if (task->handle->tryStart())
         {
-          return;  // Exit the thread
+          task->func(*task->handle->progress_ptr_, *task->handle);
+          task->handle->updateState(task->handle->isCancelled() ? TaskHandle::TaskState::Cancelled
+                                                                : TaskHandle::TaskState::Completed);
         }
-        task = tasks_.top().func;
-        tasks_.pop();
+        continue;
+      }
+
+      std::unique_lock lock(sleep_mutex_);
+      cond_.wait(lock, [this, self] { return shutdown_ || self->stop || pending_ > 0; });
+      if (shutdown_ && pending_ <= 0)
+      {
+        return;
       }
-      task();
     }
   }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  mutable std::shared_mutex workers_mutex_;
+  std::recursive_mutex thread_management_mutex_;
+  std::atomic<std::size_t> next_worker_{ 0 };
+
+  std::mutex sleep_mutex_;
+  std::condition_variable cond_;
+  std::atomic<long> pending_{ 0 };
+  std::atomic<bool> shutdown_;
 };
+
+inline bool TaskHandle::cancel()
+{
+  cancel_requested_ = true;
+
+  auto expected = TaskState::Queued;
+  if (state_.compare_exchange_strong(expected, TaskState::Cancelled))
+  {
+    if (const auto queue = queue_.lock())
+    {
+      queue->discard(this);
+    }
+    return true;
+  }
+
+  return expected == TaskState::Running;
+}
+
+inline bool TaskHandle::reprioritize(int priority)
+{
+  if (state_ != TaskState::Queued)
+  {
+    return false;
+  }
+
+  priority_ = priority;
+
+  if (const auto queue = queue_.lock())
+  {
+    return queue->reprioritize(this, priority);
+  }
+  return false;
+}
@@ -767,11 +767,37 @@ void EXIFInfo::parseIFDGPS(EntryParser& parser) {
 // Locates the JM_APP1 segment and parses it using
 // parseFromEXIFSegment() or parseFromXMPSegment()
 //
-int EXIFInfo::parseFrom(EXIFStream& stream) {
+int EXIFInfo::parseFrom(EXIFStream& input) {
   clear();
-  if (!stream.IsValid())
+  if (!input.IsValid())
     return PARSE_INVALID_JPEG;
 
+  // Keep track of the stream position so the embedded thumbnail
+  // can be reported as an offset into the whole image stream.
+  class PositionStream : public EXIFStream {
+  public:
+    explicit PositionStream(EXIFStream& stream) : stream(stream), position(0) {}
+    bool IsValid() const override {
+      return stream.IsValid();
+    }
+    const uint8_t* GetBuffer(unsigned desiredLength) override {
+      const uint8_t* const buf(stream.GetBuffer(desiredLength));
+      if (buf != NULL)
+        position += desiredLength;
+      return buf;
+    }
+    bool SkipBuffer(unsigned desiredLength) override {
+      if (!stream.SkipBuffer(desiredLength))
+        return false;
+      position += desiredLength;
+      return true;
+    }
+    uint32_t Position() const { return position; }
+  private:
+    EXIFStream& stream;
+    uint32_t position;
+  } stream(input);
+
   // Sanity check: all JPEG files start with 0xFFD8 and end with 0xFFD9
   // This check also ensures that the user has supplied a correct value for len.
   const uint8_t* buf(stream.GetBuffer(2));
@@ -797,6 +823,7 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
     while ((marker=buf[0]) == JM_START && (buf=stream.GetBuffer(1)) != NULL);
     // select marker
     uint16_t sectionLength;
+    const bool had_thumbnail = Thumbnail.hasThumbnail();
     switch (marker) {
     case 0x00:
     case 0x01:
@@ -836,6 +863,9 @@ int EXIFInfo::parseFrom(EXIFStream& stream) {
 #endif // TINYEXIF_NO_XMP_SUPPORT
         break;
       case PARSE_SUCCESS:
+        // only the segment that found the thumbnail holds the offset it is relative to
+        if (!had_thumbnail && Thumbnail.hasThumbnail())
+          Thumbnail.Offset += stream.Position() - sectionLength;
         if ((app1s|=FIELD_EXIF) == FIELD_ALL)
           return PARSE_SUCCESS;
         break;
@@ -982,6 +1012,41 @@ int EXIFInfo::parseFromEXIFSegment(const uint8_t* buf, unsigned len) {
     parseIFDImage(parser, exif_sub_ifd_offset, gps_sub_ifd_offset);
   }
 
+  // The offset to the next IFD (IFD1, for the thumbnail image) follows the
+  // IFD0 entries. IFD1 is optional and a broken one is not an error, the
+  // thumbnail is simply left out. The checks are written so they cannot
+  // wrap around for offsets near 4 GB.
+  if (!Thumbnail.hasThumbnail() && len >= 12) {
+    const unsigned ifd0_entries = EntryParser::parse16(buf + offs, alignIntel);
+    const unsigned next_ifd = EntryParser::parse32(buf + offs + 2 + 12 * ifd0_entries, alignIntel);
+    if (next_ifd != 0 && next_ifd <= len - 8) {
+      const unsigned ifd1_offset = 6 + next_ifd;
+      int num_ifd1_entries = EntryParser::parse16(buf + ifd1_offset, alignIntel);
+      if (next_ifd <= len - 12 && 12u * num_ifd1_entries <= len - 12 - next_ifd) {
+        uint32_t thumbnail_offset = 0, thumbnail_length = 0;
+        parser.Init(ifd1_offset+2);
+        while (--num_ifd1_entries >= 0) {
+          parser.ParseTag();
+          switch (parser.GetTag()) {
+          case 0x0201:
+            // JPEGInterchangeFormat, offset of the thumbnail from the TIFF header
+            parser.Fetch(thumbnail_offset);
+            break;
+          case 0x0202:
+            // JPEGInterchangeFormatLength
+            parser.Fetch(thumbnail_length);
+            break;
+          }
+        }
+        if (thumbnail_length > 0 && thumbnail_offset <= len - 6 &&
+            thumbnail_length <= len - 6 - thumbnail_offset) {
+          Thumbnail.Offset = 6 + thumbnail_offset;
+          Thumbnail.Length = thumbnail_length;
+        }
+      }
+    }
+  }
+
   // Jump to the EXIF SubIFD if it exists and parse all the information
   // there. Note that it's possible that the EXIF SubIFD doesn't exist.
   // The EXIF SubIFD contains most of the interesting information that a
@@ -1219,6 +1284,10 @@ bool EXIFInfo::GPano_t::hasPoseRollDegrees() const {
   return PoseRollDegrees != DBL_MAX;
 }
 
+bool EXIFInfo::Thumbnail_t::hasThumbnail() const {
+  return Length > 0;
+}
+
 void EXIFInfo::clear() {
   Fields = FIELD_NA;
 
@@ -1260,6 +1329,10 @@ void EXIFInfo::clear() {
   ProjectionType    = 0;
   SubjectArea.clear();
 
+  // Thumbnail
+  Thumbnail.Offset = 0;
+  Thumbnail.Length = 0;
+
   // Calibration
   Calibration.FocalLength = 0;
   Calibration.OpticalCenterX = 0;
@@ -1,6 +1,7 @@
 #include "snapdecision/databasemanager.h"
 
 #include <QDebug>
+#include <QFile>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
@@ -9,12 +10,23 @@
 #include <QVariant>
 #include <iostream>
 #include <optional>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "snapdecision/enums.h"
 
+// votes are committed together once this many are queued, or after the interval at the latest
+static constexpr std::size_t group_commit_size = 64;
+static constexpr auto group_commit_interval = std::chrono::milliseconds(250);
+
+// WAL readers only wait while a checkpoint resets the log
+static constexpr int reader_busy_timeout_ms = 5000;
+
 std::string describeDatabase(const QSqlDatabase& db)
 {
   if (!db.isOpen())
@@ -55,168 +67,627 @@ std::string describeDatabase(const QSqlDatabase& db)
   return description;
 }
 
+// Schema version 2 keeps one row per directory and keys images by (directory_id, filename), enums are
+// stored as integers. Version 1 had a single image_data table keyed by absolute path with the enums as
+// text, initializeDb() migrates those files in place. Version 3 adds the fingerprint of the file the row
+// was read from, version 2 files get the columns added.
+constexpr int schema_version = 3;
+
+// Columns of the image table. The value type is part of the column so reads and writes are checked at
+// compile time, the id selects the column's cached statements. Every column defaults to the zero
+// value of its type: 0, an empty string or the first enumerator.
+template <typename T>
+struct DatabaseColumn
+{
+  std::size_t id;
+  const char* name;
+};
+
+namespace column
+{
+constexpr DatabaseColumn<DecisionType> decision{ 0, "decision" };
+constexpr DatabaseColumn<int> image_width{ 1, "image_width" };
+constexpr DatabaseColumn<int> image_height{ 2, "image_height" };
+constexpr DatabaseColumn<std::string> make{ 3, "make" };
+constexpr DatabaseColumn<std::string> model{ 4, "model" };
+constexpr DatabaseColumn<int> bits_per_sample{ 5, "bits_per_sample" };
+constexpr DatabaseColumn<std::string> date_time{ 6, "date_time" };
+constexpr DatabaseColumn<std::string> date_time_original{ 7, "date_time_original" };
+constexpr DatabaseColumn<std::string> sub_sec_time_original{ 8, "sub_sec_time_original" };
+constexpr DatabaseColumn<double> f_number{ 9, "f_number" };
+constexpr DatabaseColumn<ExposureProgram> exposure_program{ 10, "exposure_program" };
+constexpr DatabaseColumn<int> iso_speed_ratings{ 11, "iso_speed_ratings" };
+constexpr DatabaseColumn<double> exposure_time{ 12, "exposure_time" };
+constexpr DatabaseColumn<double> aperture_value{ 13, "aperture_value" };
+constexpr DatabaseColumn<double> brightness_value{ 14, "brightness_value" };
+constexpr DatabaseColumn<double> exposure_bias_value{ 15, "exposure_bias_value" };
+constexpr DatabaseColumn<double> subject_distance{ 16, "subject_distance" };
+constexpr DatabaseColumn<double> focal_length{ 17, "focal_length" };
+constexpr DatabaseColumn<int> orientation{ 18, "orientation" };
+constexpr DatabaseColumn<MeteringMode> metering_mode{ 19, "metering_mode" };
+constexpr DatabaseColumn<std::size_t> creation_ms{ 20, "creation_ms" };
+constexpr DatabaseColumn<qint64> file_size{ 21, "file_size" };
+constexpr DatabaseColumn<qint64> file_modified_ms{ 22, "file_modified_ms" };
+constexpr DatabaseColumn<qint64> file_inode{ 23, "file_inode" };
+constexpr DatabaseColumn<qint64> file_partial_hash{ 24, "file_partial_hash" };
+
+constexpr std::size_t count = 25;
+}  // namespace column
+
+// statement cache slots, a select and an upsert per column followed by the whole row statements
+constexpr std::size_t selectSlot(std::size_t column_id)
+{
+  return 2 * column_id;
+}
+
+constexpr std::size_t updateSlot(std::size_t column_id)
+{
+  return 2 * column_id + 1;
+}
+
+constexpr std::size_t upsert_record_slot = 2 * column::count;
+constexpr std::size_t write_decision_slot = upsert_record_slot + 1;
+constexpr std::size_t select_directory_slot = write_decision_slot + 1;
+constexpr std::size_t insert_directory_slot = select_directory_slot + 1;
+constexpr std::size_t statement_slot_count = insert_directory_slot + 1;
+
+// rebuilds the absolute path of every image row
+static const QString image_join_sql = "image JOIN directory ON directory.id = image.directory_id";
+static const QString image_path_sql = "directory.path || image.filename";
+
+// "/the/full/path/image.jpg" -> { "/the/full/path/", "image.jpg" }, the directory keeps its separator so
+// joining the two is a plain concatenation
+static std::pair<std::string, std::string> splitImagePath(const std::string& image_path)
+{
+  const auto slash = image_path.find_last_of('/');
+  if (slash == std::string::npos)
+  {
+    return { "", image_path };
+  }
+  return { image_path.substr(0, slash + 1), image_path.substr(slash + 1) };
+}
+
 template <typename T>
-T getDefaultDatabaseValue(const std::string& column_name)
+QVariant toVariant(const T& value)
 {
   if constexpr (std::is_same_v<T, std::string>)
   {
-    if (column_name == "decision")
-      return to_string(DecisionType::Unknown);
-    if (column_name == "exposure_program")
-      return to_string(ExposureProgram::NotDefined);
-    if (column_name == "metering_mode")
-      return to_string(MeteringMode::Unknown);
-    if (column_name == "make" || column_name == "model" || column_name == "date_time" ||
-        column_name == "date_time_original" || column_name == "sub_sec_time_original")
-      return "";
-    // Add more string-type columns and their defaults here
+    return QString::fromStdString(value);
+  }
+  else if constexpr (std::is_enum_v<T>)
+  {
+    return static_cast<int>(value);
+  }
+  else if constexpr (std::is_same_v<T, std::size_t>)
+  {
+    return static_cast<qulonglong>(value);
+  }
+  else
+  {
+    return value;
   }
-  else if constexpr (std::is_same_v<T, int>)
+}
+
+template <typename T>
+T fromVariant(const QVariant& value)
+{
+  if constexpr (std::is_same_v<T, std::string>)
   {
-    if (column_name == "image_width" || column_name == "image_height" || column_name == "bits_per_sample" ||
-        column_name == "iso_speed_ratings" || column_name == "orientation")
-      return 0;
-    // Add more integer-type columns and their defaults here
+    return value.toString().toStdString();
   }
-  else if constexpr (std::is_same_v<T, double>)
+  else if constexpr (std::is_enum_v<T>)
   {
-    if (column_name == "f_number" || column_name == "exposure_time" || column_name == "aperture_value" ||
-        column_name == "brightness_value" || column_name == "exposure_bias_value" ||
-        column_name == "subject_distance" || column_name == "focal_length")
-      return 0.0;
-    // Add more double-type columns and their defaults here
+    return static_cast<T>(value.toInt());
   }
   else if constexpr (std::is_same_v<T, std::size_t>)
   {
-    if (column_name == "creation_ms")
-      return 0.0;
-    // Add more double-type columns and their defaults here
+    return static_cast<std::size_t>(value.toULongLong());
   }
   else
   {
-    static_assert(std::is_same_v<T, void>, "Unsupported type for getDefaultDatabaseValue");
+    return value.value<T>();
+  }
+}
+
+template <typename MakeSql>
+QSqlQuery* DatabaseManager::statement(Connection& connection, std::size_t slot, MakeSql make_sql)
+{
+  if (connection.statements.size() < statement_slot_count)
+  {
+    connection.statements.resize(statement_slot_count);
+  }
+
+  auto& cached = connection.statements[slot];
+
+  if (!cached)
+  {
+    auto query = std::make_unique<QSqlQuery>(*connection.database);
+    if (!query->prepare(make_sql()))
+    {
+      diagnostic_function_(LogLevel::Error, "Failed to prepare query: " + query->lastError().text().toStdString());
+      return nullptr;
+    }
+    cached = std::move(query);
   }
 
-  std::cerr << "Invalid column name or type for default value: " << column_name << std::endl;
-  throw std::invalid_argument("Invalid column name or type for default value: " + column_name);
+  return cached.get();
 }
 
-template <typename T>
-bool setColumnValue(QSqlDatabase& db, const DiagnosticFunction& diagnostic, const std::string& primaryKey,
-                    const std::string& column_name, const T& value)
+void DatabaseManager::dropStatements(Connection& connection)
 {
-  if (!db.isOpen())
+  connection.statements.clear();
+  connection.directory_ids.clear();
+}
+
+std::optional<qlonglong> DatabaseManager::directoryId(Connection& connection, const std::string& directory,
+                                                      bool create)
+{
+  if (const auto it = connection.directory_ids.find(directory); it != connection.directory_ids.end())
   {
-    diagnostic(LogLevel::Error, "Database is not open.");
-    return false;
+    return it->second;
   }
 
-  // Check if the row exists
-  QSqlQuery checkQuery(db);
-  checkQuery.prepare("SELECT COUNT(*) FROM image_data WHERE absolute_path = :primaryKey");
-  checkQuery.bindValue(":primaryKey", QString::fromStdString(primaryKey));
-  if (!checkQuery.exec() || !checkQuery.next())
+  if (create)
   {
-    diagnostic(LogLevel::Error, "Failed to check for existing row.");
-    return false;
+    QSqlQuery* insert = statement(connection, insert_directory_slot,
+                                  [] { return QString("INSERT OR IGNORE INTO directory (path) VALUES (:path)"); });
+    if (!insert)
+    {
+      return std::nullopt;
+    }
+
+    insert->bindValue(":path", QString::fromStdString(directory));
+    if (!insert->exec())
+    {
+      diagnostic_function_(LogLevel::Error, "Failed to add directory: " + insert->lastError().text().toStdString());
+      return std::nullopt;
+    }
   }
 
-  bool rowExists = checkQuery.value(0).toInt() > 0;
+  QSqlQuery* select =
+      statement(connection, select_directory_slot, [] { return QString("SELECT id FROM directory WHERE path = :path"); });
+  if (!select)
+  {
+    return std::nullopt;
+  }
 
-  QSqlQuery query(db);
-  QString sql;
+  select->bindValue(":path", QString::fromStdString(directory));
 
-  if (rowExists)
+  std::optional<qlonglong> id;
+  if (select->exec() && select->next())
   {
-    // Update the existing row
-    sql = QString("UPDATE image_data SET %1 = :value WHERE absolute_path = :primaryKey")
-              .arg(QString::fromStdString(column_name));
+    id = select->value(0).toLongLong();
+    connection.directory_ids[directory] = *id;
   }
-  else
+  select->finish();
+
+  return id;
+}
+
+namespace
+{
+// Run by a thread on its way out, one hook per owner.
+struct ThreadExitHooks
+{
+  std::unordered_map<const void*, std::function<void()>> hooks;
+
+  ~ThreadExitHooks()
   {
-    // Insert a new row
-    sql = QString("INSERT INTO image_data (absolute_path, %1) VALUES (:primaryKey, :value)")
-              .arg(QString::fromStdString(column_name));
+    for (auto& [owner, hook] : hooks)
+    {
+      hook();
+    }
   }
+};
 
-  query.prepare(sql);
-  query.bindValue(":primaryKey", QString::fromStdString(primaryKey));
+thread_local ThreadExitHooks thread_exit_hooks;
+}  // namespace
 
-  if constexpr (std::is_same_v<T, std::string>)
+DatabaseManager::Connection* DatabaseManager::readerConnection()
+{
+  Readers& readers = *readers_;
+  std::lock_guard lock(readers.mutex);
+
+  if (readers.location.isEmpty())
+  {
+    return nullptr;
+  }
+
+  auto& reader = readers.connections[std::this_thread::get_id()];
+
+  if (reader && reader->generation == readers.generation)
+  {
+    return reader.get();
+  }
+
+  // a thread that is done with reading takes its connection with it, instead of leaving it to whoever
+  // destroys the manager
+  const auto close_on_exit = [readers = readers_, thread = std::this_thread::get_id()]
+  {
+    std::unique_ptr<Connection> exiting;
+    {
+      std::lock_guard lock(readers->mutex);
+      if (const auto it = readers->connections.find(thread); it != readers->connections.end())
+      {
+        exiting = std::move(it->second);
+        readers->connections.erase(it);
+      }
+    }
+    if (exiting)
+    {
+      closeConnection(*exiting);
+    }
+  };
+  thread_exit_hooks.hooks.try_emplace(readers_.get(), close_on_exit);
+
+  // opened for a database the writer has moved on from, only this thread ever used it
+  if (reader)
   {
-    query.bindValue(":value", QString::fromStdString(value));
+    closeConnection(*reader);
   }
   else
   {
-    query.bindValue(":value", QVariant::fromValue(value));
+    reader = std::make_unique<Connection>();
   }
 
-  if (!query.exec())
+  static std::atomic<int> reader_count{ 0 };
+  const QString name = QString("image_reader_%1").arg(reader_count++);
+
+  auto database = std::make_shared<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE", name));
+  database->setConnectOptions(QString("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=%1").arg(reader_busy_timeout_ms));
+  database->setDatabaseName(readers.location);
+
+  if (!database->open())
+  {
+    diagnostic_function_(LogLevel::Warn, "Unable to open a reader for " + readers.location.toStdString() +
+                                             ", reading through the writer.");
+    database.reset();
+    QSqlDatabase::removeDatabase(name);
+    readers.connections.erase(std::this_thread::get_id());
+    return nullptr;
+  }
+
+  reader->database = database;
+  reader->generation = readers.generation;
+  return reader.get();
+}
+
+template <typename Read>
+auto DatabaseManager::withReader(Read read)
+{
+  if (Connection* reader = readerConnection())
   {
-    diagnostic(LogLevel::Error, "Failed to execute query: " + query.lastError().text().toStdString() +
-                                    "\nSource SQL: " + sql.toStdString());
+    return read(*reader);
+  }
+
+  std::lock_guard lock(mutex_);
+  return read(writer_);
+}
+
+template <typename T>
+bool DatabaseManager::setColumn(const DatabaseColumn<T>& column, const std::string& image_path, const T& value)
+{
+  std::lock_guard lock(mutex_);
+
+  if (!writer_.database->isOpen())
+  {
+    diagnostic_function_(LogLevel::Error, "Database is not open.");
     return false;
   }
 
-  // db.commit();
+  const auto [directory, filename] = splitImagePath(image_path);
+
+  const auto directory_id = directoryId(writer_, directory, true);
+  if (!directory_id)
+  {
+    return false;
+  }
+
+  QSqlQuery* query = statement(writer_, updateSlot(column.id),
+                               [&column]
+                               {
+                                 return QString("INSERT INTO image (directory_id, filename, %1) "
+                                                "VALUES (:directory_id, :filename, :value) "
+                                                "ON CONFLICT(directory_id, filename) DO UPDATE SET %1 = excluded.%1")
+                                     .arg(column.name);
+                               });
+  if (!query)
+  {
+    return false;
+  }
+
+  query->bindValue(":directory_id", *directory_id);
+  query->bindValue(":filename", QString::fromStdString(filename));
+  query->bindValue(":value", toVariant(value));
+
+  if (!query->exec())
+  {
+    diagnostic_function_(LogLevel::Error, "Failed to execute query: " + query->lastError().text().toStdString() +
+                                              "\nSource SQL: " + query->lastQuery().toStdString());
+    return false;
+  }
 
   return true;
 }
 
 template <typename T>
-std::optional<T> getColumnValue(QSqlDatabase& db, const DiagnosticFunction& diagnostic, const std::string& primaryKey,
-                                const std::string& columnName)
+std::optional<T> DatabaseManager::getColumn(const DatabaseColumn<T>& column, const std::string& image_path)
+{
+  return withReader(
+      [&](Connection& connection) -> std::optional<T>
+      {
+        if (!connection.database->isOpen())
+        {
+          diagnostic_function_(LogLevel::Error, "Database is not open.");
+          return std::nullopt;
+        }
+
+        const auto [directory, filename] = splitImagePath(image_path);
+
+        const auto directory_id = directoryId(connection, directory, false);
+        if (!directory_id)
+        {
+          return std::nullopt;  // nothing stored for the directory yet
+        }
+
+        QSqlQuery* query = statement(connection, selectSlot(column.id),
+                                     [&column]
+                                     {
+                                       return QString("SELECT %1 FROM image "
+                                                      "WHERE directory_id = :directory_id AND filename = :filename")
+                                           .arg(column.name);
+                                     });
+        if (!query)
+        {
+          return std::nullopt;
+        }
+
+        query->bindValue(":directory_id", *directory_id);
+        query->bindValue(":filename", QString::fromStdString(filename));
+
+        if (!query->exec())
+        {
+          diagnostic_function_(LogLevel::Error,
+                               "Failed to execute query: " + query->lastError().text().toStdString());
+          return std::nullopt;
+        }
+
+        std::optional<T> value;
+        if (query->next())
+        {
+          value = fromVariant<T>(query->value(0));
+        }
+        query->finish();  // the statement stays prepared, but must not hold on to the read
+
+        // a column at its default counts as never written
+        if (value == T{})
+        {
+          return std::nullopt;
+        }
+        return value;
+      });
+}
+
+DatabaseManager::DatabaseManager(DiagnosticFunction diagnostic_function) : diagnostic_function_(diagnostic_function)
+{
+  openWriter(createDb(":memory:"));
+
+  writer_thread_ = std::thread([this] { writerLoop(); });
+}
+
+DatabaseManager::~DatabaseManager()
 {
-  if (!db.isOpen())
   {
-    diagnostic(LogLevel::Error, "Database is not open.");
-    return std::nullopt;
+    std::lock_guard lock(writer_mutex_);
+    writer_stop_ = true;
   }
+  writer_wake_.notify_one();
 
-  T defaultValue = getDefaultDatabaseValue<T>(columnName);
+  if (writer_thread_.joinable())
+  {
+    writer_thread_.join();  // the writer flushes on its way out
+  }
 
-  QSqlQuery query(db);
-  query.prepare("SELECT " + QString::fromStdString(columnName) + " FROM image_data WHERE absolute_path = :primaryKey");
-  query.bindValue(":primaryKey", QString::fromStdString(primaryKey));
+  // Only this thread's reader is closed here, every other thread closes its own on its way out.
+  std::unique_ptr<Connection> own;
+  {
+    std::lock_guard lock(readers_->mutex);
+    readers_->location.clear();
+    if (const auto it = readers_->connections.find(std::this_thread::get_id()); it != readers_->connections.end())
+    {
+      own = std::move(it->second);
+      readers_->connections.erase(it);
+    }
+  }
+  if (own)
+  {
+    closeConnection(*own);
+  }
+}
 
-  if (!query.exec())
+void DatabaseManager::queueDecision(const std::string& image_path, DecisionType decision)
+{
+  auto* pending = new PendingDecision{ image_path, decision, pending_decisions_.load() };
+  while (!pending_decisions_.compare_exchange_weak(pending->next, pending))
   {
-    diagnostic(LogLevel::Error, "Failed to execute query: " + query.lastError().text().toStdString());
-    return std::nullopt;
   }
 
-  if (query.next())
+  wakeWriter(pending_decision_count_.fetch_add(1) + 1);
+}
+
+void DatabaseManager::queueRecord(ImageRecord record)
+{
+  auto* pending = new PendingRecord{ std::move(record), pending_records_.load() };
+  while (!pending_records_.compare_exchange_weak(pending->next, pending))
+  {
+  }
+
+  wakeWriter(pending_record_count_.fetch_add(1) + 1);
+}
+
+void DatabaseManager::wakeWriter(std::size_t queued)
+{
+  // Going from empty is the one wake-up that must not be lost, the writer sleeps without a
+  // timeout then. Taking its mutex orders this against its predicate check.
+  if (queued == 1)
+  {
+    std::lock_guard lock(writer_mutex_);
+  }
+  if (queued == 1 || queued == group_commit_size)
+  {
+    writer_wake_.notify_one();
+  }
+}
+
+void DatabaseManager::flush()
+{
+  writePending();
+}
+
+void DatabaseManager::writerLoop()
+{
+  while (true)
   {
-    if constexpr (std::is_same_v<T, std::string>)
     {
-      // Always convert to std::string for string types
-      std::string strValue = query.value(0).toString().toStdString();
-      return (strValue != defaultValue) ? std::optional<T>{ strValue } : std::nullopt;
+      std::unique_lock lock(writer_mutex_);
+      writer_wake_.wait(lock,
+                        [this] { return writer_stop_ || pending_decision_count_ > 0 || pending_record_count_ > 0; });
+
+      // give a burst of votes or records the chance to go into the same transaction
+      writer_wake_.wait_for(lock, group_commit_interval,
+                            [this]
+                            {
+                              return writer_stop_ || pending_decision_count_ >= group_commit_size ||
+                                     pending_record_count_ >= group_commit_size;
+                            });
     }
-    else
+
+    writePending();
+
+    if (writer_stop_)
     {
-      T typedValue = query.value(0).value<T>();
-      return (typedValue != defaultValue) ? std::optional<T>{ typedValue } : std::nullopt;
+      writePending();  // anything queued while the last group was written
+      return;
     }
   }
-  else
+}
+
+void DatabaseManager::writePending()
+{
+  std::lock_guard lock(mutex_);
+  writePendingRecords();
+  writePendingDecisions();
+}
+
+void DatabaseManager::writePendingRecords()
+{
+  // taken under mutex_ for the same reason as the votes
+  std::lock_guard lock(mutex_);
+
+  PendingRecord* head = pending_records_.exchange(nullptr);
+  if (!head)
   {
-    return std::nullopt;
+    return;
+  }
+
+  // newest first, an image read twice keeps what was read last
+  std::vector<ImageRecord> records;
+  std::unordered_set<std::string> seen;
+  std::size_t count = 0;
+  while (head)
+  {
+    if (seen.insert(head->record.absolute_path).second)
+    {
+      records.push_back(std::move(head->record));
+    }
+    delete std::exchange(head, head->next);
+    ++count;
   }
+  pending_record_count_ -= count;
+
+  upsertRecords(records);
 }
 
-DatabaseManager::DatabaseManager(DiagnosticFunction diagnostic_function) : diagnostic_function_(diagnostic_function)
+void DatabaseManager::writePendingDecisions()
 {
-  db = createDb(":memory:");
+  // Taking the queue while holding mutex_ means whoever gets mutex_ next sees the votes either
+  // still queued or already committed, never in flight.
+  std::lock_guard lock(mutex_);
+
+  PendingDecision* head = pending_decisions_.exchange(nullptr);
+  if (!head)
+  {
+    return;
+  }
+
+  // the stack is newest first, so the first vote seen for a path is the one to keep
+  std::unordered_map<std::string, DecisionType> latest;
+  std::size_t count = 0;
+  while (head)
+  {
+    latest.try_emplace(std::move(head->image_path), head->decision);
+    delete std::exchange(head, head->next);
+    ++count;
+  }
+  pending_decision_count_ -= count;
+
+  if (!writer_.database || !writer_.database->isOpen())
+  {
+    diagnostic_function_(LogLevel::Error, "Database is not open, dropped " + std::to_string(latest.size()) +
+                                              " decisions.");
+    return;
+  }
+
+  const bool transaction = writer_.database->transaction();
+
+  QSqlQuery* query = statement(writer_, write_decision_slot,
+                               []
+                               {
+                                 return QString("INSERT INTO image (directory_id, filename, decision) "
+                                                "VALUES (:directory_id, :filename, :decision) "
+                                                "ON CONFLICT(directory_id, filename) DO UPDATE SET decision = excluded.decision");
+                               });
+
+  for (const auto& [image_path, decision] : latest)
+  {
+    if (!query)
+    {
+      break;
+    }
+
+    const auto [directory, filename] = splitImagePath(image_path);
+    const auto directory_id = directoryId(writer_, directory, true);
+    if (!directory_id)
+    {
+      continue;
+    }
+
+    query->bindValue(":directory_id", *directory_id);
+    query->bindValue(":filename", QString::fromStdString(filename));
+    query->bindValue(":decision", toVariant(decision));
+
+    if (!query->exec())
+    {
+      diagnostic_function_(LogLevel::Error, "Failed to write decision for " + image_path + ": " +
+                                                query->lastError().text().toStdString());
+    }
+  }
+
+  if (transaction && !writer_.database->commit())
+  {
+    writer_.database->rollback();
+    diagnostic_function_(LogLevel::Error, "Failed to commit decisions.");
+  }
 }
 
 void DatabaseManager::checkpoint()
 {
   std::lock_guard lock(mutex_);
+  writePending();
 
-  if (db && db->databaseName() != ":memory:")
+  if (writer_.database && writer_.database->databaseName() != ":memory:")
   {
-    QSqlQuery query(*db);
+    QSqlQuery query(*writer_.database);
 
     if (!query.exec("PRAGMA wal_checkpoint(FULL)"))
     {
@@ -227,283 +698,615 @@ void DatabaseManager::checkpoint()
   }
 }
 
-void DatabaseManager::switchToInMemory()
+void DatabaseManager::switchToInMemory(const ProgressFunction& progress)
 {
   std::lock_guard lock(mutex_);
-  if (db && db->databaseName() != ":memory:")
+  writePending();
+  if (writer_.database && writer_.database->databaseName() != ":memory:")
   {
-    copyDataToNewDb(":memory:");
+    copyDataToNewDb(":memory:", progress);
   }
 }
 
-void DatabaseManager::switchToFileBased(const std::string& filePath)
+void DatabaseManager::switchToFileBased(const std::string& filePath, const ProgressFunction& progress)
 {
   std::lock_guard lock(mutex_);
-  if (db && db->databaseName().toStdString() != filePath)
+  writePending();
+  if (writer_.database && writer_.database->databaseName().toStdString() != filePath)
   {
-    copyDataToNewDb(QString::fromStdString(filePath));
+    copyDataToNewDb(QString::fromStdString(filePath), progress);
   }
 }
 
 std::string DatabaseManager::getLocation() const
 {
   std::lock_guard lock(mutex_);
-  if (db)
+  if (writer_.database)
   {
-    return db->databaseName().toStdString();
+    return writer_.database->databaseName().toStdString();
   }
   return "Uninitialized";
 }
 
-template <typename T, typename F>
-auto transformOptional(const T& opt, const F& func)
-{
-  using return_optional = std::optional<typename std::invoke_result<F, typename T::value_type>::type>;
-
-  if (opt.has_value())
-  {
-    return return_optional(func(opt.value()));
-  }
-  return return_optional{};
-}
-
 void DatabaseManager::setDecision(const std::string& image_path, DecisionType decision)
 {
   std::lock_guard lock(mutex_);  // mutex is recursive
-  setColumnValue(*db, diagnostic_function_, image_path, "decision", to_string(decision));
+  writePending();
+  setColumn(column::decision, image_path, decision);
 }
 
 std::optional<DecisionType> DatabaseManager::getDecision(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  const auto opt_val = getColumnValue<std::string>(*db, diagnostic_function_, image_path, "decision");
-
-  return transformOptional(opt_val, to_DecisionType);
+  writePending();
+  return getColumn(column::decision, image_path);
 }
 
 void DatabaseManager::setExposureProgram(const std::string& image_path, ExposureProgram exposureProgram)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "exposure_program", to_string(exposureProgram));
+  setColumn(column::exposure_program, image_path, exposureProgram);
 }
 
 void DatabaseManager::setMeteringMode(const std::string& image_path, MeteringMode meteringMode)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "metering_mode", to_string(meteringMode));
+  setColumn(column::metering_mode, image_path, meteringMode);
 }
 
 std::optional<ExposureProgram> DatabaseManager::getExposureProgram(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  const auto opt_val = getColumnValue<std::string>(*db, diagnostic_function_, image_path, "exposure_program");
-  return transformOptional(opt_val, to_ExposureProgram);
+  return getColumn(column::exposure_program, image_path);
 }
 
 std::optional<MeteringMode> DatabaseManager::getMeteringMode(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  const auto opt_val = getColumnValue<std::string>(*db, diagnostic_function_, image_path, "metering_mode");
-  return transformOptional(opt_val, to_MeteringMode);
+  return getColumn(column::metering_mode, image_path);
 }
 
 void DatabaseManager::setMake(const std::string& image_path, const std::string& make)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "make", make);
+  setColumn(column::make, image_path, make);
 }
 
 void DatabaseManager::setModel(const std::string& image_path, const std::string& model)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "model", model);
+  setColumn(column::model, image_path, model);
 }
 
 void DatabaseManager::setDateTime(const std::string& image_path, const std::string& dateTime)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "date_time", dateTime);
+  setColumn(column::date_time, image_path, dateTime);
 }
 
 void DatabaseManager::setDateTimeOriginal(const std::string& image_path, const std::string& dateTimeOriginal)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "date_time_original", dateTimeOriginal);
+  setColumn(column::date_time_original, image_path, dateTimeOriginal);
 }
 
 void DatabaseManager::setSubSecTimeOriginal(const std::string& image_path, const std::string& subSecTimeOriginal)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "sub_sec_time_original", subSecTimeOriginal);
+  setColumn(column::sub_sec_time_original, image_path, subSecTimeOriginal);
 }
 
 std::optional<std::string> DatabaseManager::getMake(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::string>(*db, diagnostic_function_, image_path, "make");
+  return getColumn(column::make, image_path);
 }
 
 std::optional<std::string> DatabaseManager::getModel(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::string>(*db, diagnostic_function_, image_path, "model");
+  return getColumn(column::model, image_path);
 }
 
 std::optional<std::string> DatabaseManager::getDateTime(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::string>(*db, diagnostic_function_, image_path, "date_time");
+  return getColumn(column::date_time, image_path);
 }
 
 std::optional<std::string> DatabaseManager::getDateTimeOriginal(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::string>(*db, diagnostic_function_, image_path, "date_time_original");
+  return getColumn(column::date_time_original, image_path);
 }
 
 std::optional<std::string> DatabaseManager::getSubSecTimeOriginal(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::string>(*db, diagnostic_function_, image_path, "sub_sec_time_original");
+  return getColumn(column::sub_sec_time_original, image_path);
 }
 
 void DatabaseManager::setImageWidth(const std::string& image_path, int width)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "image_width", width);
+  setColumn(column::image_width, image_path, width);
 }
 
 void DatabaseManager::setImageHeight(const std::string& image_path, int height)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "image_height", height);
+  setColumn(column::image_height, image_path, height);
 }
 
 void DatabaseManager::setBitsPerSample(const std::string& image_path, int bitsPerSample)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "bits_per_sample", bitsPerSample);
+  setColumn(column::bits_per_sample, image_path, bitsPerSample);
 }
 
 void DatabaseManager::setISOSpeedRatings(const std::string& image_path, int isoSpeedRatings)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "iso_speed_ratings", isoSpeedRatings);
+  setColumn(column::iso_speed_ratings, image_path, isoSpeedRatings);
 }
 
 void DatabaseManager::setCreationMs(const std::string& image_path, std::size_t creation_ms)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "creation_ms", creation_ms);
+  setColumn(column::creation_ms, image_path, creation_ms);
 }
 
 std::optional<int> DatabaseManager::getImageWidth(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<int>(*db, diagnostic_function_, image_path, "image_width");
+  return getColumn(column::image_width, image_path);
 }
 
 std::optional<int> DatabaseManager::getImageHeight(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<int>(*db, diagnostic_function_, image_path, "image_height");
+  return getColumn(column::image_height, image_path);
 }
 
 std::optional<int> DatabaseManager::getBitsPerSample(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<int>(*db, diagnostic_function_, image_path, "bits_per_sample");
+  return getColumn(column::bits_per_sample, image_path);
 }
 
 std::optional<int> DatabaseManager::getISOSpeedRatings(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<int>(*db, diagnostic_function_, image_path, "iso_speed_ratings");
+  return getColumn(column::iso_speed_ratings, image_path);
 }
 
 std::optional<std::size_t> DatabaseManager::getCreationMs(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<std::size_t>(*db, diagnostic_function_, image_path, "creation_ms");
+  return getColumn(column::creation_ms, image_path);
 }
 
-std::vector<std::string> DatabaseManager::getDeleteDecisionFilenames()
+static const QString upsert_record_sql =
+    "INSERT INTO image (directory_id, filename, make, model, date_time, date_time_original, sub_sec_time_original, "
+    "image_width, image_height, bits_per_sample, iso_speed_ratings, orientation, f_number, exposure_time, "
+    "aperture_value, brightness_value, exposure_bias_value, subject_distance, focal_length, exposure_program, "
+    "metering_mode, creation_ms, file_size, file_modified_ms, file_inode, file_partial_hash) "
+    "VALUES (:directory_id, :filename, :make, :model, :date_time, :date_time_original, :sub_sec_time_original, "
+    ":image_width, :image_height, :bits_per_sample, :iso_speed_ratings, :orientation, :f_number, :exposure_time, "
+    ":aperture_value, :brightness_value, :exposure_bias_value, :subject_distance, :focal_length, :exposure_program, "
+    ":metering_mode, :creation_ms, :file_size, :file_modified_ms, :file_inode, :file_partial_hash) "
+    "ON CONFLICT(directory_id, filename) DO UPDATE SET "
+    "make = excluded.make, model = excluded.model, date_time = excluded.date_time, "
+    "date_time_original = excluded.date_time_original, sub_sec_time_original = excluded.sub_sec_time_original, "
+    "image_width = excluded.image_width, image_height = excluded.image_height, "
+    "bits_per_sample = excluded.bits_per_sample, iso_speed_ratings = excluded.iso_speed_ratings, "
+    "orientation = excluded.orientation, f_number = excluded.f_number, exposure_time = excluded.exposure_time, "
+    "aperture_value = excluded.aperture_value, brightness_value = excluded.brightness_value, "
+    "exposure_bias_value = excluded.exposure_bias_value, subject_distance = excluded.subject_distance, "
+    "focal_length = excluded.focal_length, exposure_program = excluded.exposure_program, "
+    "metering_mode = excluded.metering_mode, creation_ms = excluded.creation_ms, file_size = excluded.file_size, "
+    "file_modified_ms = excluded.file_modified_ms, file_inode = excluded.file_inode, "
+    "file_partial_hash = excluded.file_partial_hash";
+
+static void bindRecord(QSqlQuery& query, qlonglong directory_id, const std::string& filename, const ImageRecord& r)
 {
-  std::lock_guard lock(mutex_);
+  const auto str = [](const std::string& s) { return QString::fromStdString(s); };
+
+  query.bindValue(":directory_id", directory_id);
+  query.bindValue(":filename", str(filename));
+  query.bindValue(":make", str(r.make));
+  query.bindValue(":model", str(r.model));
+  query.bindValue(":date_time", str(r.date_time));
+  query.bindValue(":date_time_original", str(r.date_time_original));
+  query.bindValue(":sub_sec_time_original", str(r.sub_sec_time_original));
+  query.bindValue(":image_width", r.image_width);
+  query.bindValue(":image_height", r.image_height);
+  query.bindValue(":bits_per_sample", r.bits_per_sample);
+  query.bindValue(":iso_speed_ratings", r.iso_speed_ratings);
+  query.bindValue(":orientation", r.orientation);
+  query.bindValue(":f_number", r.f_number);
+  query.bindValue(":exposure_time", r.exposure_time);
+  query.bindValue(":aperture_value", r.aperture_value);
+  query.bindValue(":brightness_value", r.brightness_value);
+  query.bindValue(":exposure_bias_value", r.exposure_bias_value);
+  query.bindValue(":subject_distance", r.subject_distance);
+  query.bindValue(":focal_length", r.focal_length);
+  query.bindValue(":exposure_program", toVariant(r.exposure_program));
+  query.bindValue(":metering_mode", toVariant(r.metering_mode));
+  query.bindValue(":creation_ms", toVariant(r.creation_ms));
+  query.bindValue(":file_size", r.fingerprint.size);
+  query.bindValue(":file_modified_ms", r.fingerprint.modified_ms);
+  query.bindValue(":file_inode", r.fingerprint.inode);
+  query.bindValue(":file_partial_hash", r.fingerprint.partial_hash);
+}
+
+bool DatabaseManager::upsertRecord(const ImageRecord& record)
+{
+  return upsertRecords(std::span<const ImageRecord>(&record, 1));
+}
+
+bool DatabaseManager::upsertRecords(std::span<const ImageRecord> records)
+{
+  if (records.empty())
+  {
+    return true;
+  }
 
-  const auto decision_text = to_string(DecisionType::Delete);
+  std::lock_guard lock(mutex_);
 
-  std::vector<std::string> paths;
+  if (!writer_.database->isOpen())
+  {
+    diagnostic_function_(LogLevel::Error, "Database is not open.");
+    return false;
+  }
 
-  // Prepare the SQL query using a placeholder for the decision text
-  QSqlQuery query(*db);
-  query.prepare("SELECT absolute_path FROM image_data WHERE decision = :decision");
+  // a single row does not need the transaction, sqlite wraps the statement in one anyway
+  const bool batch = records.size() > 1 && writer_.database->transaction();
 
-  // Bind the decision_text to the placeholder
-  query.bindValue(":decision", QString::fromStdString(decision_text));
+  QSqlQuery* query = statement(writer_, upsert_record_slot, [] { return upsert_record_sql; });
+  if (!query)
+  {
+    if (batch)
+    {
+      writer_.database->rollback();
+    }
+    return false;
+  }
 
-  // Execute the query
-  if (query.exec())
+  for (const auto& record : records)
   {
-    while (query.next())
+    const auto [directory, filename] = splitImagePath(record.absolute_path);
+    const auto directory_id = directoryId(writer_, directory, true);
+    if (!directory_id)
+    {
+      if (batch)
+      {
+        writer_.database->rollback();
+      }
+      return false;
+    }
+
+    bindRecord(*query, *directory_id, filename, record);
+
+    if (!query->exec())
     {
-      // Extract the absolute_path and add it to the vector
-      QString path = query.value(0).toString();
-      paths.push_back(path.toStdString());
+      diagnostic_function_(LogLevel::Error, "Failed to upsert " + record.absolute_path + ": " +
+                                                query->lastError().text().toStdString());
+      if (batch)
+      {
+        writer_.database->rollback();
+      }
+      return false;
     }
   }
-  else
+
+  if (batch && !writer_.database->commit())
   {
-    // Handle query execution error
-    std::cerr << "Query failed: " << query.lastError().text().toStdString() << std::endl;
+    writer_.database->rollback();
+    diagnostic_function_(LogLevel::Error, "Failed to commit upsert transaction.");
+    return false;
+  }
+
+  return true;
+}
+
+// the columns readStoredImage() expects, in order
+static const QString stored_image_sql = "SELECT " + image_path_sql +
+                                        ", decision, make, model, date_time, date_time_original, "
+                                        "sub_sec_time_original, image_width, image_height, bits_per_sample, "
+                                        "iso_speed_ratings, orientation, f_number, exposure_time, aperture_value, "
+                                        "brightness_value, exposure_bias_value, subject_distance, focal_length, "
+                                        "exposure_program, metering_mode, creation_ms, file_size, file_modified_ms, "
+                                        "file_inode, file_partial_hash FROM " +
+                                        image_join_sql;
+
+static StoredImage readStoredImage(const QSqlQuery& query)
+{
+  const auto str = [&query](int i) { return query.value(i).toString().toStdString(); };
+
+  StoredImage stored;
+  ImageRecord& r = stored.record;
+
+  r.absolute_path = str(0);
+
+  // same rule as getDecision(), a row without a vote is unclassified
+  const auto decision = fromVariant<DecisionType>(query.value(1));
+  stored.decision = decision == DecisionType::Unknown ? DecisionType::Unclassified : decision;
+
+  r.make = str(2);
+  r.model = str(3);
+  r.date_time = str(4);
+  r.date_time_original = str(5);
+  r.sub_sec_time_original = str(6);
+  r.image_width = query.value(7).toInt();
+  r.image_height = query.value(8).toInt();
+  r.bits_per_sample = query.value(9).toInt();
+  r.iso_speed_ratings = query.value(10).toInt();
+  r.orientation = query.value(11).toInt();
+  r.f_number = query.value(12).toDouble();
+  r.exposure_time = query.value(13).toDouble();
+  r.aperture_value = query.value(14).toDouble();
+  r.brightness_value = query.value(15).toDouble();
+  r.exposure_bias_value = query.value(16).toDouble();
+  r.subject_distance = query.value(17).toDouble();
+  r.focal_length = query.value(18).toDouble();
+  r.exposure_program = fromVariant<ExposureProgram>(query.value(19));
+  r.metering_mode = fromVariant<MeteringMode>(query.value(20));
+  r.creation_ms = fromVariant<std::size_t>(query.value(21));
+  r.fingerprint.size = query.value(22).toLongLong();
+  r.fingerprint.modified_ms = query.value(23).toLongLong();
+  r.fingerprint.inode = query.value(24).toLongLong();
+  r.fingerprint.partial_hash = query.value(25).toLongLong();
+
+  return stored;
+}
+
+StoredImages DatabaseManager::loadAllRecords()
+{
+  writePending();
+
+  return withReader(
+      [this](Connection& connection)
+      {
+        StoredImages rows;
+
+        if (!connection.database->isOpen())
+        {
+          diagnostic_function_(LogLevel::Error, "Database is not open.");
+          return rows;
+        }
+
+        QSqlQuery query(*connection.database);
+        query.setForwardOnly(true);  // rows are visited once, no need for Qt to keep them around
+
+        if (!query.exec(stored_image_sql))
+        {
+          diagnostic_function_(LogLevel::Error, "Failed to load image data: " + query.lastError().text().toStdString());
+          return rows;
+        }
+
+        while (query.next())
+        {
+          auto stored = readStoredImage(query);
+          const auto path = stored.record.absolute_path;
+          rows.emplace(path, std::move(stored));
+        }
+
+        return rows;
+      });
+}
+
+StoredImages DatabaseManager::loadRecordsFor(const std::vector<std::string>& image_paths)
+{
+  std::set<std::string> directories;
+  for (const auto& image_path : image_paths)
+  {
+    directories.insert(splitImagePath(image_path).first);
   }
 
-  return paths;
+  writePending();
+
+  return withReader(
+      [this, &directories](Connection& connection)
+      {
+        StoredImages rows;
+
+        if (!connection.database->isOpen())
+        {
+          diagnostic_function_(LogLevel::Error, "Database is not open.");
+          return rows;
+        }
+
+        // the directory's rows are one range of the primary key
+        QSqlQuery query(*connection.database);
+        query.setForwardOnly(true);
+        query.prepare(stored_image_sql + " WHERE directory.path = :path");
+
+        for (const auto& directory : directories)
+        {
+          query.bindValue(":path", QString::fromStdString(directory));
+
+          if (!query.exec())
+          {
+            diagnostic_function_(LogLevel::Error, "Failed to load image data for " + directory + ": " +
+                                                      query.lastError().text().toStdString());
+            continue;
+          }
+
+          while (query.next())
+          {
+            auto stored = readStoredImage(query);
+            const auto path = stored.record.absolute_path;
+            rows.emplace(path, std::move(stored));
+          }
+        }
+
+        return rows;
+      });
+}
+
+std::vector<std::string> DatabaseManager::findImages(const ImageQuery& filter)
+{
+  writePending();
+
+  return withReader(
+      [this, &filter](Connection& connection)
+      {
+        std::vector<std::string> paths;
+
+        // (decision, iso_speed_ratings) is indexed, so decision and ISO bounds narrow an index range
+        QStringList conditions;
+        if (filter.decision)
+        {
+          // a row nobody voted on counts as unclassified, like everywhere else
+          conditions << (*filter.decision == DecisionType::Unclassified ? "image.decision IN (:decision, :unknown)"
+                                                                         : "image.decision = :decision");
+        }
+        if (filter.min_iso)
+        {
+          conditions << "image.iso_speed_ratings >= :min_iso";
+        }
+        if (filter.max_iso)
+        {
+          conditions << "image.iso_speed_ratings <= :max_iso";
+        }
+        if (filter.make)
+        {
+          conditions << "image.make = :make";
+        }
+
+        QString sql = "SELECT " + image_path_sql + " FROM " + image_join_sql;
+        if (!conditions.isEmpty())
+        {
+          sql += " WHERE " + conditions.join(" AND ");
+        }
+
+        QSqlQuery query(*connection.database);
+        query.setForwardOnly(true);
+        query.prepare(sql);
+
+        if (filter.decision)
+        {
+          query.bindValue(":decision", toVariant(*filter.decision));
+          if (*filter.decision == DecisionType::Unclassified)
+          {
+            query.bindValue(":unknown", toVariant(DecisionType::Unknown));
+          }
+        }
+        if (filter.min_iso)
+        {
+          query.bindValue(":min_iso", *filter.min_iso);
+        }
+        if (filter.max_iso)
+        {
+          query.bindValue(":max_iso", *filter.max_iso);
+        }
+        if (filter.make)
+        {
+          query.bindValue(":make", QString::fromStdString(*filter.make));
+        }
+
+        if (!query.exec())
+        {
+          diagnostic_function_(LogLevel::Error, "Failed to find images: " + query.lastError().text().toStdString());
+          return paths;
+        }
+
+        while (query.next())
+        {
+          paths.push_back(query.value(0).toString().toStdString());
+        }
+
+        return paths;
+      });
+}
+
+std::vector<std::string> DatabaseManager::getDeleteDecisionFilenames()
+{
+  writePending();
+
+  return withReader(
+      [](Connection& connection)
+      {
+        std::vector<std::string> paths;
+
+        // Prepare the SQL query using a placeholder for the decision, the decision index makes this a lookup
+        QSqlQuery query(*connection.database);
+        query.prepare("SELECT " + image_path_sql + " FROM " + image_join_sql + " WHERE image.decision = :decision");
+
+        // Bind the decision to the placeholder
+        query.bindValue(":decision", toVariant(DecisionType::Delete));
+
+        // Execute the query
+        if (query.exec())
+        {
+          while (query.next())
+          {
+            // Extract the absolute path and add it to the vector
+            QString path = query.value(0).toString();
+            paths.push_back(path.toStdString());
+          }
+        }
+        else
+        {
+          // Handle query execution error
+          std::cerr << "Query failed: " << query.lastError().text().toStdString() << std::endl;
+        }
+
+        return paths;
+      });
 }
 
 void DatabaseManager::removeRowsIfAbsolutePath(std::function<bool(const std::string&)> condition)
 {
   std::lock_guard lock(mutex_);
+  writePending();
 
-  QSqlQuery query(*db);
+  QSqlQuery query(*writer_.database);
+  query.setForwardOnly(true);
 
   // Select all rows from the table
-  if (!query.exec("SELECT absolute_path FROM image_data"))
+  if (!query.exec("SELECT " + image_path_sql + ", image.directory_id, image.filename FROM " + image_join_sql))
   {
     // Handle error
     std::cerr << "Query failed: " << query.lastError().text().toStdString() << std::endl;
     return;
   }
 
+  // rows failing the condition, deleted once the scan is done
+  std::vector<std::pair<QVariant, QVariant>> doomed;
+
   while (query.next())
   {
-    QString absolutePath = query.value(0).toString();
-    std::string absolutePathStd = absolutePath.toStdString();
-
-    // Check the condition
-    if (!condition(absolutePathStd))
+    if (!condition(query.value(0).toString().toStdString()))
     {
-      // Delete the row if the condition is false
-      QSqlQuery deleteQuery;
-      deleteQuery.prepare("DELETE FROM image_data WHERE absolute_path = :absolute_path");
-      deleteQuery.bindValue(":absolute_path", absolutePath);
+      doomed.emplace_back(query.value(1), query.value(2));
+    }
+  }
+  query.finish();
 
-      if (!deleteQuery.exec())
-      {
-        // Handle error in delete operation
-        std::cerr << "Delete failed: " << deleteQuery.lastError().text().toStdString() << std::endl;
-      }
+  if (doomed.empty())
+  {
+    return;
+  }
+
+  const bool transaction = writer_.database->transaction();
+
+  QSqlQuery deleteQuery(*writer_.database);
+  deleteQuery.prepare("DELETE FROM image WHERE directory_id = :directory_id AND filename = :filename");
+
+  for (const auto& [directory_id, filename] : doomed)
+  {
+    deleteQuery.bindValue(":directory_id", directory_id);
+    deleteQuery.bindValue(":filename", filename);
+
+    if (!deleteQuery.exec())
+    {
+      // Handle error in delete operation
+      std::cerr << "Delete failed: " << deleteQuery.lastError().text().toStdString() << std::endl;
     }
   }
+
+  if (transaction && !writer_.database->commit())
+  {
+    writer_.database->rollback();
+    diagnostic_function_(LogLevel::Error, "Failed to commit row removal.");
+  }
 }
 
 bool DatabaseManager::removeRowForPath(const std::string& path)
 {
   std::lock_guard lock(mutex_);
-  QSqlQuery query(*db);
+  writePending();
+
+  const auto [directory, filename] = splitImagePath(path);
+
+  const auto directory_id = directoryId(writer_, directory, false);
+  if (!directory_id)
+  {
+    return true;  // never stored
+  }
 
-  query.prepare("DELETE FROM image_data WHERE absolute_path = :path");
-  query.bindValue(":path", QString::fromStdString(path));
+  QSqlQuery query(*writer_.database);
+
+  query.prepare("DELETE FROM image WHERE directory_id = :directory_id AND filename = :filename");
+  query.bindValue(":directory_id", *directory_id);
+  query.bindValue(":filename", QString::fromStdString(filename));
 
   if (!query.exec())
   {
@@ -517,202 +1320,204 @@ bool DatabaseManager::removeRowForPath(const std::string& path)
 
 void DatabaseManager::setFNumber(const std::string& image_path, double fNumber)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "f_number", fNumber);
+  setColumn(column::f_number, image_path, fNumber);
 }
 
 void DatabaseManager::setExposureTime(const std::string& image_path, double shutterSpeedValue)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "exposure_time", shutterSpeedValue);
+  setColumn(column::exposure_time, image_path, shutterSpeedValue);
 }
 
 void DatabaseManager::setApertureValue(const std::string& image_path, double apertureValue)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "aperture_value", apertureValue);
+  setColumn(column::aperture_value, image_path, apertureValue);
 }
 
 void DatabaseManager::setBrightnessValue(const std::string& image_path, double brightnessValue)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "brightness_value", brightnessValue);
+  setColumn(column::brightness_value, image_path, brightnessValue);
 }
 
 void DatabaseManager::setExposureBiasValue(const std::string& image_path, double value)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "exposure_bias_value", value);
+  setColumn(column::exposure_bias_value, image_path, value);
 }
 
 void DatabaseManager::setSubjectDistance(const std::string& image_path, double value)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "subject_distance", value);
+  setColumn(column::subject_distance, image_path, value);
 }
 
 void DatabaseManager::setFocalLength(const std::string& image_path, double value)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "focal_length", value);
+  setColumn(column::focal_length, image_path, value);
 }
 
 void DatabaseManager::setOrientation(const std::string& image_path, int value)
 {
-  std::lock_guard lock(mutex_);
-  setColumnValue(*db, diagnostic_function_, image_path, "orientation", value);
+  setColumn(column::orientation, image_path, value);
 }
 
 std::optional<double> DatabaseManager::getFNumber(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "f_number");
+  return getColumn(column::f_number, image_path);
 }
 
 std::optional<double> DatabaseManager::getShutterSpeedValue(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "exposure_time");
+  return getColumn(column::exposure_time, image_path);
 }
 
 std::optional<double> DatabaseManager::getApertureValue(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "aperture_value");
+  return getColumn(column::aperture_value, image_path);
 }
 
 std::optional<double> DatabaseManager::getBrightnessValue(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "brightness_value");
+  return getColumn(column::brightness_value, image_path);
 }
 
 std::optional<double> DatabaseManager::getExposureBiasValue(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "exposure_bias_value");
+  return getColumn(column::exposure_bias_value, image_path);
 }
 
 std::optional<double> DatabaseManager::getSubjectDistance(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "subject_distance");
+  return getColumn(column::subject_distance, image_path);
 }
 
 std::optional<double> DatabaseManager::getFocalLength(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<double>(*db, diagnostic_function_, image_path, "focal_length");
+  return getColumn(column::focal_length, image_path);
 }
 
 std::optional<int> DatabaseManager::getOrientation(const std::string& image_path)
 {
-  std::lock_guard lock(mutex_);
-  return getColumnValue<int>(*db, diagnostic_function_, image_path, "orientation");
+  return getColumn(column::orientation, image_path);
 }
 
 std::array<std::size_t, 5> DatabaseManager::getDecisionCounts()
 {
-  std::lock_guard lock(mutex_);
-  QSqlQuery query(*db);
+  writePending();
 
-  std::array<std::size_t, 5> counts;
-  counts[0] = 0;
-  counts[1] = 0;
-  counts[2] = 0;
-  counts[3] = 0;
-  counts[4] = 0;
-
-  // SQL query to count different DecisionType values
-  std::string countQuery = "SELECT decision, COUNT(decision) FROM image_data GROUP BY decision";
-
-  if (!query.exec(QString::fromStdString(countQuery)))
-  {
-    // Handle the error appropriately
-    diagnostic_function_(LogLevel::Error, "Failed to execute query: " + query.lastQuery().toStdString());
-  }
-  else
-  {
-    while (query.next())
-    {
-      std::string decisionType = query.value(0).toString().toStdString();
-
-      switch (to_DecisionType(decisionType))
+  return withReader(
+      [this](Connection& connection)
       {
-        case DecisionType::Unknown:
-          counts[0] += query.value(1).toULongLong();
-          break;
-        case DecisionType::Delete:
-          counts[1] += query.value(1).toULongLong();
-          break;
-        case DecisionType::Unclassified:
-          counts[2] += query.value(1).toULongLong();
-          break;
-      case DecisionType::Keep:
-        counts[3] += query.value(1).toULongLong();
-        break;
-      case DecisionType::SuperKeep:
-        counts[4] += query.value(1).toULongLong();
-        break;
-      }
-    }
-  }
-  return counts;
+        QSqlQuery query(*connection.database);
+
+        std::array<std::size_t, 5> counts;
+        counts[0] = 0;
+        counts[1] = 0;
+        counts[2] = 0;
+        counts[3] = 0;
+        counts[4] = 0;
+
+        // SQL query to count different DecisionType values
+        std::string countQuery = "SELECT decision, COUNT(decision) FROM image GROUP BY decision";
+
+        if (!query.exec(QString::fromStdString(countQuery)))
+        {
+          // Handle the error appropriately
+          diagnostic_function_(LogLevel::Error, "Failed to execute query: " + query.lastQuery().toStdString());
+        }
+        else
+        {
+          while (query.next())
+          {
+            switch (fromVariant<DecisionType>(query.value(0)))
+            {
+              case DecisionType::Unknown:
+                counts[0] += query.value(1).toULongLong();
+                break;
+              case DecisionType::Delete:
+                counts[1] += query.value(1).toULongLong();
+                break;
+              case DecisionType::Unclassified:
+                counts[2] += query.value(1).toULongLong();
+                break;
+            case DecisionType::Keep:
+              counts[3] += query.value(1).toULongLong();
+              break;
+            case DecisionType::SuperKeep:
+              counts[4] += query.value(1).toULongLong();
+              break;
+            }
+          }
+        }
+        return counts;
+      });
 }
 
 void DatabaseManager::close()
 {
   std::lock_guard lock(mutex_);
+  writePending();
 
-  db->commit();
-  db->close();
-  db.reset();
-  QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
-  db = createDb(":memory:");
+  closeDb();
+  openWriter(createDb(":memory:"));
 }
 
 void DatabaseManager::initializeDb(QSqlDatabase& target)
 {
-  std::string defaultDecision = to_string(DecisionType::Unknown);
-  std::string defaultExposureProgram = to_string(ExposureProgram::NotDefined);
-  std::string defaultMeteringMode = to_string(MeteringMode::Unknown);
-
-  std::string sqlCommand = "CREATE TABLE IF NOT EXISTS image_data ("
-                           "absolute_path TEXT PRIMARY KEY, "
-                           "decision TEXT DEFAULT '" +
-                           defaultDecision +
-                           "', "
-                           "image_width INTEGER DEFAULT 0, "
-                           "image_height INTEGER DEFAULT 0, "
-                           "make TEXT DEFAULT '', "
-                           "model TEXT DEFAULT '', "
-                           "bits_per_sample INTEGER DEFAULT 0, "
-                           "date_time TEXT DEFAULT '', "
-                           "date_time_original TEXT DEFAULT '', "
-                           "sub_sec_time_original TEXT DEFAULT '', "
-                           "f_number REAL DEFAULT 0.0, "
-                           "exposure_program TEXT DEFAULT '" +
-                           defaultExposureProgram +
-                           "', "
-                           "iso_speed_ratings INTEGER DEFAULT 0, "
-                           "exposure_time REAL DEFAULT 0.0, "
-                           "aperture_value REAL DEFAULT 0.0, "
-                           "brightness_value REAL DEFAULT 0.0, "
-                           "exposure_bias_value REAL DEFAULT 0.0, "
-                           "subject_distance REAL DEFAULT 0.0, "
-                           "focal_length REAL DEFAULT 0.0, "
-                           "orientation INTEGER DEFAULT 0.0, "
-                           "metering_mode TEXT DEFAULT '" +
-                           defaultMeteringMode +
-                           "', "
-                           "creation_ms BIGINT DEFAULT 0)";
+  // enum columns hold the enumerator's value, 0 being Unknown or NotDefined
+  const QStringList schema = { "CREATE TABLE IF NOT EXISTS directory ("
+                               "id INTEGER PRIMARY KEY, "
+                               "path TEXT NOT NULL UNIQUE)",
+                               "CREATE TABLE IF NOT EXISTS image ("
+                               "directory_id INTEGER NOT NULL REFERENCES directory(id), "
+                               "filename TEXT NOT NULL, "
+                               "decision INTEGER DEFAULT 0, "
+                               "image_width INTEGER DEFAULT 0, "
+                               "image_height INTEGER DEFAULT 0, "
+                               "make TEXT DEFAULT '', "
+                               "model TEXT DEFAULT '', "
+                               "bits_per_sample INTEGER DEFAULT 0, "
+                               "date_time TEXT DEFAULT '', "
+                               "date_time_original TEXT DEFAULT '', "
+                               "sub_sec_time_original TEXT DEFAULT '', "
+                               "f_number REAL DEFAULT 0.0, "
+                               "exposure_program INTEGER DEFAULT 0, "
+                               "iso_speed_ratings INTEGER DEFAULT 0, "
+                               "exposure_time REAL DEFAULT 0.0, "
+                               "aperture_value REAL DEFAULT 0.0, "
+                               "brightness_value REAL DEFAULT 0.0, "
+                               "exposure_bias_value REAL DEFAULT 0.0, "
+                               "subject_distance REAL DEFAULT 0.0, "
+                               "focal_length REAL DEFAULT 0.0, "
+                               "orientation INTEGER DEFAULT 0, "
+                               "metering_mode INTEGER DEFAULT 0, "
+                               "creation_ms BIGINT DEFAULT 0, "
+                               "file_size BIGINT DEFAULT 0, "
+                               "file_modified_ms BIGINT DEFAULT 0, "
+                               "file_inode BIGINT DEFAULT 0, "
+                               "file_partial_hash BIGINT DEFAULT 0, "
+                               "PRIMARY KEY (directory_id, filename)) WITHOUT ROWID",
+                               "DROP INDEX IF EXISTS image_decision",  // covered by the one below
+                               "CREATE INDEX IF NOT EXISTS image_decision_iso ON image (decision, iso_speed_ratings)" };
 
   QSqlQuery query(target);
-  if (!query.exec(QString::fromStdString(sqlCommand)))
+  for (const auto& sql : schema)
   {
-    // Handle the error appropriately
-    diagnostic_function_(LogLevel::Error, "Failed to execute query: " + query.lastQuery().toStdString());
-    diagnostic_function_(LogLevel::Error, "Failed to create table: " + query.lastError().text().toStdString());
+    if (!query.exec(sql))
+    {
+      // Handle the error appropriately
+      diagnostic_function_(LogLevel::Error, "Failed to execute query: " + query.lastQuery().toStdString());
+      diagnostic_function_(LogLevel::Error, "Failed to create table: " + query.lastError().text().toStdString());
+    }
+  }
+
+  migrateFromVersion2(target);
+
+  if (target.tables().contains("image_data"))
+  {
+    migrateFromVersion1(target);
+  }
+
+  if (!target.tables().contains("image_data") && !query.exec(QString("PRAGMA user_version = %1").arg(schema_version)))
+  {
+    diagnostic_function_(LogLevel::Error, "Failed to set the schema version.");
   }
 
   if (!query.exec("PRAGMA synchronous = NORMAL"))
@@ -725,16 +1530,180 @@ void DatabaseManager::initializeDb(QSqlDatabase& target)
   }
 }
 
-std::shared_ptr<QSqlDatabase> DatabaseManager::createDb(const QString& db_name, const QString& connection)
+// Returns the directory's id in the database insert and select were prepared on, adding it if needed.
+static std::optional<qlonglong> findOrAddDirectory(QSqlQuery& insert, QSqlQuery& select, const QString& path)
+{
+  insert.bindValue(":path", path);
+  if (!insert.exec())
+  {
+    return std::nullopt;
+  }
+
+  select.bindValue(":path", path);
+  if (!select.exec() || !select.next())
+  {
+    return std::nullopt;
+  }
+
+  const qlonglong id = select.value(0).toLongLong();
+  select.finish();
+  return id;
+}
+
+void DatabaseManager::migrateFromVersion2(QSqlDatabase& target)
+{
+  QSqlQuery query(target);
+
+  QStringList existing;
+  if (query.exec("PRAGMA table_info(image)"))
+  {
+    while (query.next())
+    {
+      existing << query.value(1).toString();
+    }
+  }
+
+  // the rows keep a zero fingerprint, which never matches a file, so their EXIF data is read once more
+  for (const char* name : { column::file_size.name, column::file_modified_ms.name, column::file_inode.name,
+                            column::file_partial_hash.name })
+  {
+    if (!existing.contains(name) &&
+        !query.exec(QString("ALTER TABLE image ADD COLUMN %1 BIGINT DEFAULT 0").arg(name)))
+    {
+      diagnostic_function_(LogLevel::Error, "Failed to add column " + std::string(name) + ": " +
+                                                query.lastError().text().toStdString());
+    }
+  }
+}
+
+void DatabaseManager::migrateFromVersion1(QSqlDatabase& target)
 {
-  auto database = [&connection]()
+  const auto fail = [this, &target](const std::string& message)
+  {
+    target.rollback();
+    diagnostic_function_(LogLevel::Error, "Failed to migrate " + target.databaseName().toStdString() + ": " + message);
+  };
+
+  if (!target.transaction())
+  {
+    diagnostic_function_(LogLevel::Error, "Failed to start transaction for the schema migration.");
+    return;
+  }
+
+  QSqlQuery source(target);
+  source.setForwardOnly(true);
+  if (!source.exec("SELECT * FROM image_data"))
+  {
+    fail(source.lastError().text().toStdString());
+    return;
+  }
+
+  // everything but the key carries over under the same name
+  QStringList columns;
+  QStringList bind_names;
+  const QSqlRecord fields = source.record();
+  for (int i = 0; i < fields.count(); ++i)
+  {
+    if (fields.fieldName(i) != "absolute_path")
+    {
+      columns << fields.fieldName(i);
+      bind_names << ":" + fields.fieldName(i);
+    }
+  }
+
+  QSqlQuery insert_directory(target);
+  insert_directory.prepare("INSERT OR IGNORE INTO directory (path) VALUES (:path)");
+  QSqlQuery select_directory(target);
+  select_directory.prepare("SELECT id FROM directory WHERE path = :path");
+
+  QSqlQuery insert_image(target);
+  insert_image.prepare(QString("INSERT OR REPLACE INTO image (directory_id, filename, %1) "
+                               "VALUES (:directory_id, :filename, %2)")
+                           .arg(columns.join(", "), bind_names.join(", ")));
+
+  std::unordered_map<std::string, qlonglong> directory_ids;
+  std::size_t migrated = 0;
+
+  while (source.next())
   {
-    if (connection.isEmpty())
+    const auto [directory, filename] = splitImagePath(source.value("absolute_path").toString().toStdString());
+
+    auto it = directory_ids.find(directory);
+    if (it == directory_ids.end())
+    {
+      const auto id = findOrAddDirectory(insert_directory, select_directory, QString::fromStdString(directory));
+      if (!id)
+      {
+        fail("could not add directory " + directory);
+        return;
+      }
+      it = directory_ids.emplace(directory, *id).first;
+    }
+
+    insert_image.bindValue(":directory_id", it->second);
+    insert_image.bindValue(":filename", QString::fromStdString(filename));
+
+    for (const auto& column_name : columns)
+    {
+      QVariant value = source.value(column_name);
+
+      // version 1 stored the enums as text
+      if (column_name == "decision")
+      {
+        value = toVariant(to_DecisionType(value.toString().toStdString()));
+      }
+      else if (column_name == "exposure_program")
+      {
+        value = toVariant(to_ExposureProgram(value.toString().toStdString()));
+      }
+      else if (column_name == "metering_mode")
+      {
+        value = toVariant(to_MeteringMode(value.toString().toStdString()));
+      }
+
+      insert_image.bindValue(":" + column_name, value);
+    }
+
+    if (!insert_image.exec())
     {
-      return std::make_shared<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE"));
+      fail(insert_image.lastError().text().toStdString());
+      return;
     }
-    return std::make_shared<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE", connection));
-  }();
+    ++migrated;
+  }
+  source.finish();
+
+  QSqlQuery query(target);
+  if (!query.exec("DROP TABLE image_data"))
+  {
+    fail(query.lastError().text().toStdString());
+    return;
+  }
+
+  if (!target.commit())
+  {
+    fail("commit failed");
+    return;
+  }
+
+  diagnostic_function_(LogLevel::Info, "Migrated " + std::to_string(migrated) + " rows of " +
+                                           target.databaseName().toStdString() + " to schema version " +
+                                           std::to_string(schema_version));
+
+  // give the space of the old table back
+  if (!query.exec("VACUUM"))
+  {
+    diagnostic_function_(LogLevel::Warn, "Failed to vacuum after the migration.");
+  }
+}
+
+std::shared_ptr<QSqlDatabase> DatabaseManager::createDb(const QString& db_name)
+{
+  // every connection gets its own name, the old and the new database are both open while switching
+  static std::atomic<int> connection_count{ 0 };
+  const QString connection = QString("image_database_%1").arg(connection_count++);
+
+  auto database = std::make_shared<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE", connection));
 
   database->setDatabaseName(db_name);
   if (!database->open())
@@ -749,96 +1718,207 @@ std::shared_ptr<QSqlDatabase> DatabaseManager::createDb(const QString& db_name,
   return database;
 }
 
-void DatabaseManager::copyDataToNewDb(const QString& new_db_name)
+void DatabaseManager::closeConnection(Connection& connection)
 {
-  auto temp_db = createDb(":memory:", "temp_db");
+  dropStatements(connection);
 
-  if (!temp_db->open())
+  if (!connection.database)
   {
-    diagnostic_function_(LogLevel::Error, "Unable to open temp database.");
     return;
   }
 
-  copyDbContents(*db, *temp_db);
+  const QString name = connection.database->connectionName();
+
+  connection.database->commit();
+  connection.database->close();
+  connection.database.reset();
+  QSqlDatabase::removeDatabase(name);
+}
+
+void DatabaseManager::closeDb()
+{
+  closeConnection(writer_);
+}
+
+void DatabaseManager::openWriter(const std::shared_ptr<QSqlDatabase>& database)
+{
+  writer_.database = database;
+
+  // Readers reopen on their next read. An in-memory database only exists on the writer's connection.
+  std::lock_guard lock(readers_->mutex);
+  const QString location = database->databaseName();
+  readers_->location = database->isOpen() && location != ":memory:" ? location : QString();
+  ++readers_->generation;
+}
 
-  db->commit();
-  db->close();
-  db.reset();
-  QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
-  db = createDb(new_db_name);
+void DatabaseManager::copyDataToNewDb(const QString& new_db_name, const ProgressFunction& progress)
+{
+  auto new_db = createDb(new_db_name);
 
-  if (!db->open())
+  if (!new_db->isOpen())
   {
     diagnostic_function_(LogLevel::Error, "Unable to open new database.");
+    const QString connection = new_db->connectionName();
+    new_db.reset();
+    QSqlDatabase::removeDatabase(connection);
     return;
   }
 
-  copyDbContents(*temp_db, *db);
+  {
+    // SQLite can only attach files, so the file side is attached to the other side's connection
+    const bool from_file = writer_.database->databaseName() != ":memory:";
+    QSqlDatabase& host = from_file ? *new_db : *writer_.database;
+
+    QSqlQuery attach(host);
+    attach.prepare("ATTACH DATABASE :file AS other");
+    attach.bindValue(":file", from_file ? writer_.database->databaseName() : new_db_name);
+
+    if (!attach.exec())
+    {
+      diagnostic_function_(LogLevel::Error, "Failed to attach database: " + attach.lastError().text().toStdString());
+    }
+    else
+    {
+      copyRows(host, from_file ? "other" : "main", from_file ? "main" : "other", progress);
 
-  temp_db->commit();
-  temp_db->close();
-  temp_db.reset();
+      if (!attach.exec("DETACH DATABASE other"))
+      {
+        diagnostic_function_(LogLevel::Error, "Failed to detach database: " + attach.lastError().text().toStdString());
+      }
+    }
+  }
 
-  QSqlDatabase::removeDatabase("temp_db");
+  closeDb();
+  openWriter(new_db);
 }
 
-void DatabaseManager::copyDbContents(QSqlDatabase& source_db, QSqlDatabase& target_db)
+// every image column but the key
+static QString imageValueColumns(const QString& prefix)
 {
-  initializeDb(target_db);
+  const std::array<const char*, column::count> names = {
+    column::decision.name,          column::image_width.name,        column::image_height.name,
+    column::make.name,              column::model.name,              column::bits_per_sample.name,
+    column::date_time.name,         column::date_time_original.name, column::sub_sec_time_original.name,
+    column::f_number.name,          column::exposure_program.name,   column::iso_speed_ratings.name,
+    column::exposure_time.name,     column::aperture_value.name,     column::brightness_value.name,
+    column::exposure_bias_value.name, column::subject_distance.name, column::focal_length.name,
+    column::orientation.name,       column::metering_mode.name,      column::creation_ms.name,
+    column::file_size.name,         column::file_modified_ms.name,   column::file_inode.name,
+    column::file_partial_hash.name
+  };
+
+  QStringList columns;
+  for (const char* name : names)
+  {
+    columns << prefix + name;
+  }
+  return columns.join(", ");
+}
+
+// rows copied per statement while switching databases, progress is reported in between
+static constexpr qlonglong copy_chunk_rows = 4096;
 
-  if (!target_db.transaction())
+bool DatabaseManager::copyRows(QSqlDatabase& host, const QString& from, const QString& to,
+                               const ProgressFunction& progress)
+{
+  QSqlQuery query(host);
+
+  qlonglong total = 0;
+  if (query.exec(QString("SELECT COUNT(*) FROM %1.image").arg(from)) && query.next())
+  {
+    total = query.value(0).toLongLong();
+  }
+  query.finish();
+
+  if (!host.transaction())
   {
     diagnostic_function_(LogLevel::Error, "Failed to start transaction on target database.");
-    return;
+    return false;
   }
 
-  QSqlQuery sourceQuery(source_db);
-  if (!sourceQuery.exec("SELECT * FROM image_data"))
+  const auto fail = [&](const QSqlQuery& failed)
   {
-    target_db.rollback();  // Rollback the transaction
+    diagnostic_function_(LogLevel::Error, "Failed to copy database: " + failed.lastError().text().toStdString());
+    diagnostic_function_(LogLevel::Error, describeDatabase(host));
+    host.rollback();
+    return false;
+  };
 
-    diagnostic_function_(LogLevel::Error, "Failed to execute query on source database.");
-    diagnostic_function_(LogLevel::Error, describeDatabase(source_db));
-    return;
+  // Directory ids are local to a database, so rows are matched up through the directory's path.
+  if (!query.exec(QString("INSERT OR IGNORE INTO %2.directory (path) SELECT path FROM %1.directory").arg(from, to)))
+  {
+    return fail(query);
   }
 
-  QStringList columnNames;
-  QStringList bindValues;
-  for (int i = 0; i < sourceQuery.record().count(); ++i)
+  // Chunks are walked along the primary key, each one starts where the last ended instead of skipping
+  // over every row copied so far.
+  QSqlQuery boundary(host);
+  boundary.prepare(QString("SELECT directory_id, filename FROM %1.image "
+                           "WHERE (directory_id, filename) > (:last_dir, :last_name) "
+                           "ORDER BY directory_id, filename LIMIT 1 OFFSET :offset")
+                       .arg(from));
+
+  QSqlQuery copy(host);
+  copy.prepare(QString("INSERT OR REPLACE INTO %2.image (directory_id, filename, %3) "
+                       "SELECT target_directory.id, i.filename, %4 FROM %1.image i "
+                       "JOIN %1.directory source_directory ON source_directory.id = i.directory_id "
+                       "JOIN %2.directory target_directory ON target_directory.path = source_directory.path "
+                       "WHERE (i.directory_id, i.filename) > (:last_dir, :last_name) "
+                       "ORDER BY i.directory_id, i.filename LIMIT :limit")
+                   .arg(from, to, imageValueColumns(""), imageValueColumns("i.")));
+
+  QVariant last_dir = qlonglong{ -1 };
+  QVariant last_name = QString();
+  for (qlonglong copied = 0; copied < total; copied += copy_chunk_rows)
   {
-    QString fieldName = sourceQuery.record().fieldName(i);
-    columnNames << fieldName;
-    bindValues << ":" + fieldName;
-  }
+    // the key of the chunk's last row, nothing once the chunk runs to the end of the table
+    boundary.bindValue(":last_dir", last_dir);
+    boundary.bindValue(":last_name", last_name);
+    boundary.bindValue(":offset", copy_chunk_rows - 1);
+    if (!boundary.exec())
+    {
+      return fail(boundary);
+    }
+    const bool more = boundary.next();
+    const QVariant next_dir = more ? boundary.value(0) : QVariant();
+    const QVariant next_name = more ? boundary.value(1) : QVariant();
+    boundary.finish();
 
-  QString insertSql =
-      QString("INSERT OR REPLACE INTO image_data (%1) VALUES (%2)").arg(columnNames.join(", "), bindValues.join(", "));
+    copy.bindValue(":last_dir", last_dir);
+    copy.bindValue(":last_name", last_name);
+    copy.bindValue(":limit", copy_chunk_rows);
 
-  while (sourceQuery.next())
-  {
-    QSqlQuery insertQuery(target_db);
-    insertQuery.prepare(insertSql);
+    if (!copy.exec())
+    {
+      return fail(copy);
+    }
 
-    for (int i = 0; i < sourceQuery.record().count(); ++i)
+    if (progress)
     {
-      insertQuery.bindValue(":" + sourceQuery.record().fieldName(i), sourceQuery.value(i));
+      progress(std::min(1.0, static_cast<double>(copied + copy_chunk_rows) / static_cast<double>(total)));
     }
 
-    if (!insertQuery.exec())
+    if (!more)
     {
-      QString err = "Failed to insert data: " + insertQuery.lastError().text() + "\n";
-      diagnostic_function_(LogLevel::Error, err.toStdString());
-      target_db.rollback();
-      return;
+      break;
     }
+    last_dir = next_dir;
+    last_name = next_name;
   }
 
-  if (!target_db.commit())
+  if (!host.commit())
   {
-    target_db.rollback();  // Rollback the transaction
+    host.rollback();  // Rollback the transaction
     diagnostic_function_(LogLevel::Error, "Failed to commit transaction on target database.");
-    return;
+    return false;
+  }
+
+  if (progress)
+  {
+    progress(1.0);
   }
+
+  return true;
 }
 
 #include <cassert>
@@ -872,6 +1952,11 @@ bool DatabaseManager::unitTest()
   auto decision2 = dbManager.getDecision(testImagePath2);
   assert(decision2.has_value() && decision2.value() == DecisionType::Delete);
 
+  // another thread reads through its own connection and sees the committed vote
+  std::optional<DecisionType> decision2_elsewhere;
+  std::thread([&] { decision2_elsewhere = dbManager.getDecision(testImagePath2); }).join();
+  assert(decision2_elsewhere == DecisionType::Delete);
+
   // Switch back to in-memory and ensure the first decision is not present
   dbManager.switchToInMemory();
   auto decision1InMemory = dbManager.getDecision(testImagePath1);
@@ -896,6 +1981,100 @@ bool DatabaseManager::unitTest()
   auto creationTime3 = dbManager.getCreationMs(testImagePath3);
   assert(!creationTime3.has_value() || creationTime3.value() == 0);
 
+  // Test that an upsert writes every column and leaves the decision alone
+  ImageRecord record;
+  record.absolute_path = testImagePath1;
+  record.make = "Canon";
+  record.iso_speed_ratings = 800;
+  record.f_number = 2.8;
+  record.exposure_program = ExposureProgram::AperturePriority;
+  record.creation_ms = 987654321;
+  record.fingerprint = { 2048, 1700000000000, 77, -5 };
+  assert(dbManager.upsertRecord(record));
+  assert(dbManager.getMake(testImagePath1) == std::optional<std::string>("Canon"));
+  assert(dbManager.getISOSpeedRatings(testImagePath1) == std::optional<int>(800));
+  assert(dbManager.getFNumber(testImagePath1) == std::optional<double>(2.8));
+  assert(dbManager.getExposureProgram(testImagePath1) == std::optional(ExposureProgram::AperturePriority));
+  assert(dbManager.getCreationMs(testImagePath1) == std::optional<std::size_t>(987654321));
+  assert(dbManager.getDecision(testImagePath1) == std::optional(DecisionType::Delete));
+
+  // and that a batch inserts new rows
+  std::vector<ImageRecord> batch(2);
+  batch[0].absolute_path = "/path/to/image4.jpg";
+  batch[0].creation_ms = 4;
+  batch[1].absolute_path = "/path/to/image5.jpg";
+  batch[1].creation_ms = 5;
+  assert(dbManager.upsertRecords(batch));
+  assert(dbManager.getCreationMs("/path/to/image4.jpg") == std::optional<std::size_t>(4));
+  assert(dbManager.getCreationMs("/path/to/image5.jpg") == std::optional<std::size_t>(5));
+
+  // Test that the bulk load sees the same rows as the per-column getters
+  const auto stored = dbManager.loadAllRecords();
+  assert(stored.size() == 5);
+  assert(stored.at(testImagePath1).decision == DecisionType::Delete);
+  assert(stored.at(testImagePath1).record.make == "Canon");
+  assert(stored.at(testImagePath1).record.exposure_program == ExposureProgram::AperturePriority);
+  assert(stored.at(testImagePath1).record.creation_ms == 987654321);
+  assert(stored.at(testImagePath1).record.fingerprint.sameStat(record.fingerprint));
+  assert(stored.at(testImagePath1).record.fingerprint.sameContents(record.fingerprint));
+  assert(stored.at("/path/to/image4.jpg").decision == DecisionType::Unclassified);
+
+  // Test that queued votes are coalesced and visible to the next read
+  dbManager.queueDecision("/path/to/image4.jpg", DecisionType::Keep);
+  dbManager.queueDecision("/path/to/image4.jpg", DecisionType::SuperKeep);
+  assert(dbManager.getDecision("/path/to/image4.jpg") == std::optional(DecisionType::SuperKeep));
+  dbManager.queueDecision("/path/to/image5.jpg", DecisionType::Delete);
+  dbManager.flush();
+  assert(dbManager.getDecisionCounts()[1] == 3);
+
+  // and so are queued records, the one read last wins
+  ImageRecord reread = batch[0];
+  reread.creation_ms = 44;
+  dbManager.queueRecord(reread);
+  reread.creation_ms = 444;
+  dbManager.queueRecord(reread);
+  dbManager.flush();
+  assert(dbManager.getCreationMs("/path/to/image4.jpg") == std::optional<std::size_t>(444));
+
+  // Test that rows of other directories stay out of a folder's load and that queries span directories
+  ImageRecord elsewhere;
+  elsewhere.absolute_path = "/other/folder/image6.jpg";
+  elsewhere.iso_speed_ratings = 12800;
+  assert(dbManager.upsertRecord(elsewhere));
+  dbManager.setDecision(elsewhere.absolute_path, DecisionType::SuperKeep);
+  assert(dbManager.loadRecordsFor({ testImagePath1 }).size() == 5);
+  assert(dbManager.loadRecordsFor({ elsewhere.absolute_path }).size() == 1);
+  const auto high_iso_keepers = dbManager.findImages({ .decision = DecisionType::SuperKeep, .min_iso = 6401 });
+  assert(high_iso_keepers == std::vector<std::string>{ elsewhere.absolute_path });
+  assert(dbManager.findImages({ .decision = DecisionType::SuperKeep }).size() == 2);
+
+  // Test that a version 1 database is migrated in place when it is opened
+  QFile::remove("legacy_test.db");
+  {
+    auto legacy = QSqlDatabase::addDatabase("QSQLITE", "legacy");
+    legacy.setDatabaseName("legacy_test.db");
+    assert(legacy.open());
+    {
+      QSqlQuery query(legacy);
+      query.exec("CREATE TABLE image_data (absolute_path TEXT PRIMARY KEY, decision TEXT DEFAULT 'unknown', "
+                 "exposure_program TEXT DEFAULT 'not defined', creation_ms BIGINT DEFAULT 0)");
+      query.prepare("INSERT INTO image_data VALUES (:path, :decision, :program, :creation_ms)");
+      query.bindValue(":path", "/legacy/a.jpg");
+      query.bindValue(":decision", QString::fromStdString(to_string(DecisionType::Keep)));
+      query.bindValue(":program", QString::fromStdString(to_string(ExposureProgram::Manual)));
+      query.bindValue(":creation_ms", 42);
+      assert(query.exec());
+    }
+    legacy.close();
+  }
+  QSqlDatabase::removeDatabase("legacy");
+
+  dbManager.switchToFileBased("legacy_test.db");
+  assert(dbManager.getDecision("/legacy/a.jpg") == std::optional(DecisionType::Keep));
+  assert(dbManager.getExposureProgram("/legacy/a.jpg") == std::optional(ExposureProgram::Manual));
+  assert(dbManager.getCreationMs("/legacy/a.jpg") == std::optional<std::size_t>(42));
+  assert(dbManager.getDecision(testImagePath1) == std::optional(DecisionType::Delete));
+
   std::cout << "All DB tests passed successfully.\n";
 
   return true;
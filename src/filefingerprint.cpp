@@ -0,0 +1,103 @@
+#include "snapdecision/filefingerprint.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <cstdint>
+#include <set>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// hashing this much of each end catches rewritten metadata as well as appended or truncated data
+constexpr qint64 partial_hash_bytes = 64 * 1024;
+
+static qint64 toMs(qint64 seconds, qint64 nanoseconds)
+{
+  return seconds * 1000 + nanoseconds / 1000000;
+}
+
+FileStat statFile(const QFileInfo& file_info)
+{
+  FileStat stat;
+
+  // One call for everything, QFileInfo would stat the file itself and still not know the inode.
+#if defined(Q_OS_LINUX) && defined(STATX_BASIC_STATS)
+  struct statx st;
+  if (::statx(AT_FDCWD, QFile::encodeName(file_info.absoluteFilePath()).constData(), 0,
+              STATX_BASIC_STATS | STATX_BTIME, &st) == 0)
+  {
+    if (st.stx_mask & STATX_BTIME)
+    {
+      stat.birth_ms = static_cast<std::size_t>(toMs(st.stx_btime.tv_sec, st.stx_btime.tv_nsec));
+    }
+    stat.fingerprint.size = static_cast<qint64>(st.stx_size);
+    stat.fingerprint.modified_ms = toMs(st.stx_mtime.tv_sec, st.stx_mtime.tv_nsec);
+    stat.fingerprint.inode = static_cast<qint64>(st.stx_ino);
+    return stat;
+  }
+#elif defined(Q_OS_DARWIN)
+  struct stat st;
+  if (::stat(QFile::encodeName(file_info.absoluteFilePath()).constData(), &st) == 0)
+  {
+    stat.birth_ms = static_cast<std::size_t>(toMs(st.st_birthtimespec.tv_sec, st.st_birthtimespec.tv_nsec));
+    stat.fingerprint.size = static_cast<qint64>(st.st_size);
+    stat.fingerprint.modified_ms = toMs(st.st_mtimespec.tv_sec, st.st_mtimespec.tv_nsec);
+    stat.fingerprint.inode = static_cast<qint64>(st.st_ino);
+    return stat;
+  }
+#endif
+
+  stat.birth_ms = static_cast<std::size_t>(file_info.birthTime().toMSecsSinceEpoch());
+  stat.fingerprint.size = file_info.size();
+  stat.fingerprint.modified_ms = file_info.lastModified().toMSecsSinceEpoch();
+  stat.fingerprint.inode = static_cast<qint64>(stat.birth_ms);
+  return stat;
+}
+
+FileStats statDirectories(const std::vector<std::string>& image_paths)
+{
+  std::set<QString> directories;
+  for (const auto& image_path : image_paths)
+  {
+    directories.insert(QFileInfo(QString::fromStdString(image_path)).absolutePath());
+  }
+
+  FileStats stats;
+  for (const auto& directory : directories)
+  {
+    // the listing only names the files, each one then costs a single stat
+    for (const QFileInfo& file_info : QDir(directory).entryInfoList(QDir::Files | QDir::Hidden))
+    {
+      stats.emplace(file_info.absoluteFilePath().toStdString(), statFile(file_info));
+    }
+  }
+  return stats;
+}
+
+qint64 partialHash(const std::string& file_path)
+{
+  QFile file(QString::fromStdString(file_path));
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    return 0;
+  }
+
+  QByteArray data = file.read(partial_hash_bytes);
+  // files between one and two blocks long get an overlapping tail so their last bytes count too
+  if (file.size() > partial_hash_bytes && file.seek(file.size() - partial_hash_bytes))
+  {
+    data += file.read(partial_hash_bytes);
+  }
+
+  // FNV-1a
+  std::uint64_t hash = 14695981039346656037ull;
+  for (const char c : data)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return static_cast<qint64>(hash);
+}
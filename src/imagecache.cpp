@@ -1,25 +1,27 @@
 #include "snapdecision/imagecache.h"
 
+#include <QCoreApplication>
 #include <QImage>
 #include <QImageReader>
+#include <QThread>
+#include <algorithm>
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <utility>
 
+#include "snapdecision/TinyEXIF.h"
 #include "snapdecision/libjpegturbo_loader.h"
 #include "snapdecision/utils.h"
 
-static std::size_t calculatePixmapMemoryUsage(const QPixmap& pixmap)
+static std::size_t calculateImageMemoryUsage(const QImage& image)
 {
-  if (pixmap.isNull())
+  if (image.isNull())
   {
     return 0;
   }
 
-  const int width = pixmap.width();
-  const int height = pixmap.height();
-  const int depth = pixmap.depth();
-
-  return static_cast<std::size_t>(width * height * depth / 8);
+  return static_cast<std::size_t>(image.sizeInBytes());
 }
 
 ImageCacheHandle::ImageCacheHandle(std::weak_ptr<ImageCache> image_cache, const std::string& image_path)
@@ -27,111 +29,335 @@ ImageCacheHandle::ImageCacheHandle(std::weak_ptr<ImageCache> image_cache, const
 {
 }
 
-static QPixmap loadPixmap(const std::string& image_path)
+static bool isCancelled(const TaskHandle* task)
+{
+  return task && task->isCancelled();
+}
+
+static QImage loadImage(const std::string& image_path, const QSize& target, QSize& full_size, const TaskHandle* task)
 {
+  if (isCancelled(task))
+  {
+    return QImage();
+  }
+
   auto start = std::chrono::high_resolution_clock::now();
 
-  if (QImage img = libjpegturboOpen(QString::fromStdString(image_path)); !img.isNull())
+  if (QImage img = libjpegturboOpen(QString::fromStdString(image_path), target, &full_size); !img.isNull())
   {
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
     std::cout << image_path << " 1: " << duration.count() << " microseconds" << std::endl;
 
-    return QPixmap::fromImage(img);
+    if (isCancelled(task))
+    {
+      return QImage();
+    }
+
+    return img;
   }
 
   QImageReader img_reader(QString::fromStdString(image_path));
 
-  if (!img_reader.canRead())
+  if (!img_reader.canRead() || isCancelled(task))
   {
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
     std::cout << image_path << " 2: " << duration.count() << " microseconds" << std::endl;
 
-    return QPixmap();
+    return QImage();
   }
 
   img_reader.setAutoTransform(true);
   QImage img = img_reader.read();
+  full_size = img.size();
   auto stop = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
   std::cout << image_path << " 3: " << duration.count() << " microseconds" << std::endl;
-  return QPixmap::fromImage(img);
+
+  if (isCancelled(task))
+  {
+    return QImage();
+  }
+
+  return img;
 }
 
-QPixmap ImageCacheHandle::blockingImage()
+static bool exceeds(const QSize& size, const QSize& target)
 {
-  QPixmap return_value;
+  return target.isValid() && (size.width() > target.width() || size.height() > target.height());
+}
+
+// The formats QPainter draws without converting first.
+static QImage toDisplayFormat(const QImage& img)
+{
+  if (img.isNull() || img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32_Premultiplied)
+  {
+    return img;
+  }
+
+  return img.convertToFormat(img.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+}
+
+static QImage scaleToTier(const QImage& img, const QSize& target)
+{
+  if (img.isNull() || !exceeds(img.size(), target))
   {
-    std::lock_guard lock(mutex_);
+    return img;
+  }
+
+  return img.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+ImageCacheHandle::TierSlot& ImageCacheHandle::slot(ImageTier tier)
+{
+  return tiers_[static_cast<std::size_t>(tier)];
+}
 
-    if (!pixmap_.isNull())
+const ImageCacheHandle::TierSlot& ImageCacheHandle::slot(ImageTier tier) const
+{
+  return tiers_[static_cast<std::size_t>(tier)];
+}
+
+QImage ImageCacheHandle::blockingImage(ImageTier tier)
+{
+  return load(tier, nullptr);
+}
+
+QImage ImageCacheHandle::blockingImage(const TaskHandle& task, ImageTier tier)
+{
+  return load(tier, &task);
+}
+
+// Scales down a larger tier that is already resident instead of decoding again.
+// Only ever try_locks the larger tiers, a decode in progress there is not waited for.
+QImage ImageCacheHandle::deriveFromLargerTier(ImageTier tier, const QSize& target)
+{
+  for (auto i = static_cast<std::size_t>(tier) + 1; i < image_tier_count; ++i)
+  {
+    auto& larger = tiers_[i];
+
+    std::unique_lock lock(larger.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || larger.image.isNull())
     {
-      touch();
-      return pixmap_;
+      continue;
     }
 
-    pixmap_ = loadPixmap(image_path_);
-    memory_ = calculatePixmapMemoryUsage(pixmap_);
-    state_ = State::Complete;
-    touch();
+    return scaleToTier(larger.image, target);
+  }
+
+  return QImage();
+}
+
+QImage ImageCacheHandle::loadEmbeddedPreview(const QSize& target)
+{
+  // not seen by ingest (e.g. the EXIF data came from the database), only the header needs reading
+  if (!preview_known_)
+  {
+    std::ifstream file(image_path_, std::ifstream::in | std::ifstream::binary);
+    TinyEXIF::EXIFInfo exif(file);
+
+    setEmbeddedPreview(exif.Thumbnail.Offset, exif.Thumbnail.Length, QSize(exif.ImageWidth, exif.ImageHeight));
+  }
+
+  if (preview_length_ == 0)
+  {
+    return QImage();
+  }
+
+  return libjpegturboOpenEmbedded(QString::fromStdString(image_path_), preview_offset_, preview_length_, target);
+}
+
+QImage ImageCacheHandle::load(ImageTier tier, const TaskHandle* task)
+{
+  auto& s = slot(tier);
+
+  // read before taking the tier mutex, the cache mutex is always taken first
+  QSize target;
+  if (auto cache = image_cache_.lock())
+  {
+    target = cache->tierSize(tier);
+  }
+
+  // A thumbnail asked for on the GUI thread is what the embedded preview gives, the GUI thread neither
+  // decodes the whole file nor waits for a load that does. The load it schedules fills the tier in.
+  const auto* app = QCoreApplication::instance();
+  const bool preview_only = tier == ImageTier::Thumbnail && app && QThread::currentThread() == app->thread();
 
-    if (pixmap_.isNull())
+  QImage return_value;
+  bool loaded = false;
+  {
+    std::unique_lock lock(s.mutex, std::defer_lock);
+    if (!preview_only)
+    {
+      lock.lock();
+    }
+    else if (!lock.try_lock())
     {
-      ImageCache::getDiagFunction(image_cache_)(LogLevel::Error, "Failed to load image: " + image_path_);
+      return QImage();
+    }
+
+    if (!s.image.isNull())
+    {
+      s.state = State::Complete;
+      return_value = s.image;
+    }
+    else
+    {
+      const State previous_state = s.state;
+      s.state = State::Running;
+
+      s.image = deriveFromLargerTier(tier, target);
+
+      if (s.image.isNull() && tier == ImageTier::Thumbnail)
+      {
+        s.image = scaleToTier(toDisplayFormat(loadEmbeddedPreview(target)), target);
+      }
+
+      if (s.image.isNull() && preview_only)
+      {
+        s.state = previous_state;
+        return QImage();
+      }
+
+      if (s.image.isNull())
+      {
+        QSize full_size;
+        const auto decode_start = std::chrono::steady_clock::now();
+        const QImage img = loadImage(image_path_, target, full_size, task);
+
+        if (auto cache = image_cache_.lock(); cache && !img.isNull())
+        {
+          const auto decode_time = std::chrono::steady_clock::now() - decode_start;
+          cache->recordDecodeTime(tier, std::chrono::duration_cast<std::chrono::microseconds>(decode_time).count());
+        }
+
+        if (!img.isNull() && full_size.isValid())
+        {
+          full_width_ = full_size.width();
+          full_height_ = full_size.height();
+        }
+
+        s.image = scaleToTier(toDisplayFormat(img), target);
+      }
+
+      if (s.image.isNull() && isCancelled(task))
+      {
+        s.state = State::Cancelled;
+        return QImage();
+      }
+
+      s.memory = calculateImageMemoryUsage(s.image);
+      s.state = State::Complete;
+
+      if (s.image.isNull())
+      {
+        ImageCache::getDiagFunction(image_cache_)(LogLevel::Error, "Failed to load image: " + image_path_);
+      }
+      loaded = !s.image.isNull();
+      return_value = s.image;
     }
-    return_value = pixmap_;
   }
 
-  if (auto cache = image_cache_.lock())
+  // want to touch and manage cache without holding the tier mutex
+  if (loaded)
   {
-    // want to manage cache without holding mutex_
-    cache->manageCache();
+    last_touch_ = getCurrentTimeMilliseconds();
+
+    if (auto cache = image_cache_.lock())
+    {
+      cache->onLoaded(this, tier);
+      cache->manageCache();
+      cache->signal_emitter.emitImageLoaded(image_path_, tier);
+    }
+  }
+  else if (!return_value.isNull())
+  {
+    touch(tier);
   }
 
   return return_value;
 }
 
-QPixmap ImageCacheHandle::image()
+QImage ImageCacheHandle::image(ImageTier tier)
 {
-  std::lock_guard lock(mutex_);
+  QImage img;
+  {
+    auto& s = slot(tier);
+    std::lock_guard lock(s.mutex);
+    img = s.image;
+  }
 
-  if (!pixmap_.isNull())
+  if (!img.isNull())
   {
-    touch();
+    touch(tier);
   }
 
-  return pixmap_;
+  return img;
 }
 
-void ImageCacheHandle::scheduleImage()
+std::shared_ptr<TaskHandle> ImageCacheHandle::scheduleImage(int priority, ImageTier tier)
 {
-  std::lock_guard lock(mutex_);
+  if (slot(tier).state == State::Complete)
+  {
+    return nullptr;
+  }
 
-  if (state_ == State::Queued)
+  const auto cache = image_cache_.lock();
+  if (!cache)
+  {
+    makeDefaultDiagnosticFunction()(LogLevel::Error, "Cannot schedule an image when there is no backing cache");
+    return nullptr;
+  }
+
+  std::lock_guard lock(cache->cache_mutex_);
+  return cache->pendingLoad(image_path_, priority, tier).task;
+}
+
+void ImageCacheHandle::withdraw(ImageTier tier, const std::shared_ptr<TaskHandle>& load)
+{
+  const auto cache = image_cache_.lock();
+  if (!load || !cache || !cache->withdrawRequest(image_path_, tier, load.get()))
   {
     return;
   }
 
-  if (const auto cache = image_cache_.lock())
+  auto& s = slot(tier);
   {
-    state_ = State::Queued;
-    cache->scheduleImage(image_path_);
+    std::lock_guard lock(task_mutex_);
+    if (s.task == load)
+    {
+      s.task = nullptr;
+    }
   }
-  else
+
+  if (load->cancel())
   {
-    makeDefaultDiagnosticFunction()(LogLevel::Error, "Cannot schedule an image when there is no backing cache");
+    // a running load notices the cancellation and marks itself
+    auto expected = State::Queued;
+    s.state.compare_exchange_strong(expected, State::Cancelled);
   }
 }
 
-ImageCacheHandle::State ImageCacheHandle::getState() const
+void ImageCacheHandle::attachTask(ImageTier tier, const std::shared_ptr<TaskHandle>& task)
+{
+  std::lock_guard lock(task_mutex_);
+  slot(tier).task = task;
+}
+
+ImageCacheHandle::State ImageCacheHandle::getState(ImageTier tier) const
 {
-  return state_;
+  return slot(tier).state;
 }
 
-void ImageCacheHandle::touch()
+void ImageCacheHandle::touch(ImageTier tier)
 {
   last_touch_ = getCurrentTimeMilliseconds();
+
+  if (auto cache = image_cache_.lock())
+  {
+    cache->touch(this, tier);
+  }
 }
 
 std::string ImageCacheHandle::imagePath() const
@@ -144,9 +370,45 @@ std::shared_ptr<ImageCache> ImageCacheHandle::cache() const
   return image_cache_.lock();
 }
 
+QSize ImageCacheHandle::fullSize() const
+{
+  const int width = full_width_;
+  const int height = full_height_;
+
+  if (width <= 0 || height <= 0)
+  {
+    return QSize();
+  }
+  return QSize(width, height);
+}
+
+bool ImageCacheHandle::hasEmbeddedPreview() const
+{
+  return preview_known_ && preview_length_ > 0;
+}
+
+void ImageCacheHandle::setEmbeddedPreview(std::uint32_t offset, std::uint32_t length, const QSize& full_size)
+{
+  preview_offset_ = offset;
+  preview_length_ = length;
+  preview_known_ = true;
+
+  // a decode knows better, only fill in the size if nothing has been decoded yet
+  if (full_size.isValid() && full_width_ == 0)
+  {
+    full_width_ = full_size.width();
+    full_height_ = full_size.height();
+  }
+}
+
 std::size_t ImageCacheHandle::memory() const
 {
-  return memory_;
+  std::size_t total = 0;
+  for (const auto& s : tiers_)
+  {
+    total += s.memory;
+  }
+  return total;
 }
 
 std::size_t ImageCacheHandle::lastUsage() const
@@ -154,18 +416,32 @@ std::size_t ImageCacheHandle::lastUsage() const
   return last_touch_;
 }
 
-void ImageCacheHandle::unload()
+std::size_t ImageCacheHandle::unload(ImageTier tier)
 {
-  std::lock_guard lock(mutex_);
+  auto& s = slot(tier);
+  std::lock_guard lock(s.mutex);
 
-  pixmap_ = QPixmap();
-  state_ = State::Unloaded;
-  memory_ = 0;
+  s.image = QImage();
+  s.state = State::Unloaded;
+  return s.memory.exchange(0);
 }
 
 ImageCache::ImageCache(const TaskQueue::Ptr& task_queue, DiagnosticFunction diag_function)
   : diag_func_(diag_function), task_queue_(task_queue)
 {
+  setTierSize(ImageTier::Thumbnail, QSize(256, 256));
+  setTierSize(ImageTier::Screen, QSize(2560, 1440));
+  setMaxMemoryUsage(1000 * 1000 * 1000);
+}
+
+ImageCache::TierCache& ImageCache::tierCache(ImageTier tier)
+{
+  return tiers_[static_cast<std::size_t>(tier)];
+}
+
+const ImageCache::TierCache& ImageCache::tierCache(ImageTier tier) const
+{
+  return tiers_[static_cast<std::size_t>(tier)];
 }
 
 ImageCacheHandle::Ptr ImageCache::getHandle(const std::string& image_path)
@@ -177,71 +453,213 @@ ImageCacheHandle::Ptr ImageCache::getHandle(const std::string& image_path)
     return ptr;
   }
 
+  if (cache_.size() >= next_reclaim_size_)
+  {
+    reclaimHandles();
+    next_reclaim_size_ = std::max<std::size_t>(1024, 2 * cache_.size());
+  }
+
   cache_[image_path] = std::make_shared<ImageCacheHandle>(shared_from_this(), image_path);
   return cache_[image_path];
 }
 
-ImageCacheHandle::Ptr ImageCache::getImage(const std::string& image_path)
+ImageCacheHandle::Ptr ImageCache::getImage(const std::string& image_path, ImageTier tier)
 {
-  std::lock_guard lock(cache_mutex_);
+  return scheduleImage(image_path, 0, tier);
+}
 
-  scheduleImage(image_path);
-  return cache_[image_path];
+ImageCacheHandle::Ptr ImageCache::immediateGetImage(const std::string& image_path, ImageTier tier)
+{
+  blockingLoadToCache(image_path, tier);
+  return getHandle(image_path);
 }
 
-ImageCacheHandle::Ptr ImageCache::immediateGetImage(const std::string& image_path)
+ImageCacheHandle::Ptr ImageCache::scheduleImage(const std::string& image_path, int priority, ImageTier tier)
 {
+  requestImage(image_path, priority, tier);
+  return getHandle(image_path);
+}
+
+namespace
+{
+// Resolves the shared future even when the task is dropped from the queue
+// without ever running.
+struct PendingResult
+{
+  std::promise<QImage> promise;
+  bool fulfilled{ false };
+
+  void set(const QImage& image)
+  {
+    promise.set_value(image);
+    fulfilled = true;
+  }
+
+  ~PendingResult()
+  {
+    if (!fulfilled)
+    {
+      promise.set_value(QImage());
+    }
+  }
+};
+}  // namespace
+
+std::shared_future<QImage> ImageCache::requestImage(const std::string& image_path, int priority, ImageTier tier)
+{
+  // already decoded, nothing to queue
+  if (const QImage image = getHandle(image_path)->image(tier); !image.isNull())
+  {
+    std::promise<QImage> ready;
+    ready.set_value(image);
+    return ready.get_future().share();
+  }
+
   std::lock_guard lock(cache_mutex_);
+  return pendingLoad(image_path, priority, tier).result;
+}
 
-  blockingLoadToCache(image_path);
-  return cache_[image_path];
+ImageCache::PendingLoad& ImageCache::pendingLoad(const std::string& image_path, int priority, ImageTier tier)
+{
+  const auto handle = getHandle(image_path);
+
+  auto& pending_loads = tierCache(tier).pending_loads;
+
+  if (const auto it = pending_loads.find(image_path); it != pending_loads.end() && !it->second.task->isCancelled())
+  {
+    const auto& task = it->second.task;
+    if (priority > task->getPriority())
+    {
+      task->reprioritize(priority);
+    }
+
+    ++it->second.requesters;
+    ++coalesced_count_;
+    return it->second;
+  }
+
+  auto pending = std::make_shared<PendingResult>();
+  std::shared_future<QImage> result = pending->promise.get_future().share();
+
+  // mark as queued before submitting so a fast worker cannot be overwritten
+  handle->slot(tier).state = ImageCacheHandle::State::Queued;
+
+  // the worker needs cache_mutex_ to finish, so it cannot get ahead of the bookkeeping below
+  const auto task = task_queue_->submit(
+      [this, image_path, tier, pending](double&, const TaskHandle& task)
+      {
+        const QImage image = blockingLoadToCache(image_path, tier, &task);
+        finishPendingLoad(image_path, tier, &task);
+        pending->set(image);
+      },
+      priority);
+
+  auto& pending_load = pending_loads[image_path];
+  pending_load = { task, result };
+  handle->attachTask(tier, task);
+
+  return pending_load;
 }
 
-ImageCacheHandle::Ptr ImageCache::scheduleImage(const std::string& image_path)
+bool ImageCache::withdrawRequest(const std::string& image_path, ImageTier tier, const TaskHandle* task)
 {
   std::lock_guard lock(cache_mutex_);
 
-  if (!cache_[image_path])
+  // a load that finished, or was replaced by a new one, is nobody's to cancel any more
+  auto& pending_loads = tierCache(tier).pending_loads;
+  const auto it = pending_loads.find(image_path);
+  if (it == pending_loads.end() || it->second.task.get() != task || --it->second.requesters > 0)
   {
-    cache_[image_path] = std::make_shared<ImageCacheHandle>(shared_from_this(), image_path);
+    return false;
   }
 
-  task_queue_->submit([this, image_path](double&) { blockingLoadToCache(image_path); });
+  pending_loads.erase(it);
+  return true;
+}
 
-  return cache_[image_path];
+std::size_t ImageCache::coalescedLoadCount() const
+{
+  return coalesced_count_;
 }
 
-CurrentMaxCount ImageCache::getMemoryUsage() const
+std::size_t ImageCache::averageDecodeTimeUs(ImageTier tier) const
+{
+  return tierCache(tier).average_decode_us;
+}
+
+void ImageCache::recordDecodeTime(ImageTier tier, std::size_t us)
+{
+  // moving average, racing updates from different workers just lose a sample
+  auto& average = tierCache(tier).average_decode_us;
+  const std::size_t previous = average;
+  average = previous == 0 ? us : (previous * 7 + us) / 8;
+}
+
+void ImageCache::finishPendingLoad(const std::string& image_path, ImageTier tier, const TaskHandle* task)
 {
   std::lock_guard lock(cache_mutex_);
 
-  std::size_t i = 0;
-  for (const auto& [k, v] : cache_)
+  auto& pending_loads = tierCache(tier).pending_loads;
+  if (const auto it = pending_loads.find(image_path); it != pending_loads.end() && it->second.task.get() == task)
+  {
+    pending_loads.erase(it);
+  }
+}
+
+CurrentMaxCount ImageCache::getMemoryUsage() const
+{
+  CurrentMaxCount total{ 0, 0, 0 };
+  for (const auto& t : tiers_)
   {
-    if (v && v->getState() == ImageCacheHandle::State::Complete)
-      i++;
+    std::get<0>(total) += t.memory_usage;
+    std::get<1>(total) += t.max_memory_usage;
+    std::get<2>(total) += t.loaded_count;
   }
+  return total;
+}
 
-  return { totalMemoryUsage(), max_memory_usage_, i };
+CurrentMaxCount ImageCache::getMemoryUsage(ImageTier tier) const
+{
+  const auto& t = tierCache(tier);
+  return { t.memory_usage, t.max_memory_usage, t.loaded_count };
 }
 
 std::size_t ImageCache::totalMemoryUsage() const
 {
-  std::lock_guard lock(cache_mutex_);
+  return std::get<0>(getMemoryUsage());
+}
 
-  std::size_t total_memory_usage = 0;
+void ImageCache::setMaxMemoryUsage(std::size_t max_memory_usage)
+{
+  const std::size_t thumbnail = max_memory_usage / 20;
+  const std::size_t screen = max_memory_usage * 11 / 20;
+
+  setMaxMemoryUsage(ImageTier::Thumbnail, thumbnail);
+  setMaxMemoryUsage(ImageTier::Screen, screen);
+  setMaxMemoryUsage(ImageTier::Full, max_memory_usage - thumbnail - screen);
+}
 
-  for (const auto& [key, value] : cache_)
+void ImageCache::setMaxMemoryUsage(ImageTier tier, std::size_t max_memory_usage)
+{
+  tierCache(tier).max_memory_usage = max_memory_usage;
+
+  // idle pixel buffers kept for reuse come on top of the tier, a quarter of it at most
+  if (tier == ImageTier::Full)
   {
-    total_memory_usage += value ? value->memory() : 0;
+    libjpegturboSetBufferPoolLimit(max_memory_usage / 4);
   }
+}
 
-  return total_memory_usage;
+void ImageCache::setTierSize(ImageTier tier, const QSize& size)
+{
+  std::lock_guard lock(cache_mutex_);
+  tierCache(tier).target_size = size;
 }
 
-void ImageCache::setMaxMemoryUsage(std::size_t max_memory_usage)
+QSize ImageCache::tierSize(ImageTier tier) const
 {
-  max_memory_usage_ = max_memory_usage;
+  std::lock_guard lock(cache_mutex_);
+  return tierCache(tier).target_size;
 }
 
 DiagnosticFunction ImageCache::getDiagFunction(const ImageCache::WeakPtr& wp)
@@ -264,53 +682,119 @@ DiagnosticFunction ImageCache::diagFunction() const
   return makeDefaultDiagnosticFunction();
 }
 
-void ImageCache::blockingLoadToCache(const std::string& image_path)
+QImage ImageCache::blockingLoadToCache(const std::string& image_path, ImageTier tier, const TaskHandle* task)
 {
   if (image_path.empty())
   {
     diag_func_(LogLevel::Error, " image_path is empty");
-    return;
+    return QImage();
+  }
+
+  const auto ptr = getHandle(image_path);
+
+  if (task)
+  {
+    return ptr->blockingImage(*task, tier);
   }
+  return ptr->blockingImage(tier);
+}
 
-  auto ptr = [this, &image_path]()
+void ImageCache::manageCache()
+{
+  CurrentMaxCount usage;
   {
     std::lock_guard lock(cache_mutex_);
 
-    if (!cache_[image_path])
+    for (std::size_t i = 0; i < image_tier_count; ++i)
     {
-      cache_[image_path] = std::make_shared<ImageCacheHandle>(shared_from_this(), image_path);
+      const auto tier = static_cast<ImageTier>(i);
+      auto& t = tiers_[i];
+
+      while (t.memory_usage > t.max_memory_usage && !t.lru.empty())
+      {
+        ImageCacheHandle* oldest = t.lru.back();
+        t.lru.pop_back();
+        oldest->slot(tier).in_lru = false;
+
+        t.memory_usage -= oldest->unload(tier);
+        --t.loaded_count;
+
+        // nothing outside the cache refers to it and no other tier is resident, so the handle can go as well
+        const bool resident =
+            std::any_of(oldest->tiers_.begin(), oldest->tiers_.end(), [](const auto& s) { return s.in_lru; });
+        if (const auto it = cache_.find(oldest->imagePath());
+            !resident && it != cache_.end() && it->second.get() == oldest && it->second.use_count() == 1)
+        {
+          cache_.erase(it);
+        }
+      }
     }
+    usage = getMemoryUsage();
+  }
 
-    return cache_[image_path];
-  }();
-
-  ptr->blockingImage();
-
-  // manageCache();
+  signal_emitter.emitMemoryUsageChanged(usage);
 }
 
-void ImageCache::manageCache()
+void ImageCache::onLoaded(ImageCacheHandle* handle, ImageTier tier)
 {
-  CurrentMaxCount usage;
+  std::lock_guard lock(cache_mutex_);
+
+  auto& t = tierCache(tier);
+  auto& s = handle->slot(tier);
+
+  if (s.in_lru)
   {
-    std::lock_guard lock(cache_mutex_);
+    t.lru.splice(t.lru.begin(), t.lru, s.lru_position);
+    return;
+  }
 
-    while (totalMemoryUsage() > max_memory_usage_ && !cache_.empty())
-    {
-      // find the oldest with data and remove it
-      auto comp = [](const auto& a, const auto& b)
-      { return a.second->memory() > 0 && (b.second->memory() == 0 || a.second->lastUsage() < b.second->lastUsage()); };
+  t.lru.push_front(handle);
+  s.lru_position = t.lru.begin();
+  s.in_lru = true;
+
+  t.memory_usage += s.memory;
+  ++t.loaded_count;
+}
 
-      auto it = std::min_element(cache_.begin(), cache_.end(), comp);
+void ImageCache::touch(ImageCacheHandle* handle, ImageTier tier)
+{
+  std::lock_guard lock(cache_mutex_);
 
-      it->second->unload();
+  auto& t = tierCache(tier);
+  auto& s = handle->slot(tier);
 
-      // cache_.erase(it);
-    }
-    usage = getMemoryUsage();
+  if (s.in_lru)
+  {
+    t.lru.splice(t.lru.begin(), t.lru, s.lru_position);
   }
+}
 
-  signal_emitter.emitMemoryUsageChanged(usage);
+void ImageCache::reclaimHandles()
+{
+  std::lock_guard lock(cache_mutex_);
+
+  std::erase_if(cache_,
+                [](const auto& entry)
+                {
+                  const auto& [path, handle] = entry;
+                  if (!handle)
+                  {
+                    return true;
+                  }
+
+                  if (handle.use_count() != 1)
+                  {
+                    return false;
+                  }
+
+                  return std::none_of(handle->tiers_.begin(), handle->tiers_.end(),
+                                      [](const auto& s)
+                                      {
+                                        const auto state = s.state.load();
+                                        return s.in_lru || state == ImageCacheHandle::State::Queued ||
+                                               state == ImageCacheHandle::State::Running;
+                                      });
+                });
 }
 
 void ImageCache::updateHitMiss(std::size_t hit_inc, std::size_t miss_inc)
@@ -330,3 +814,8 @@ void ImageCacheSupport::SignalEmitter::emitHitMissUpdate(CountPair cp)
 {
   emit hitMissUpdate(cp);
 }
+
+void ImageCacheSupport::SignalEmitter::emitImageLoaded(const std::string& image_path, ImageTier tier)
+{
+  emit imageLoaded(QString::fromStdString(image_path), static_cast<int>(tier));
+}
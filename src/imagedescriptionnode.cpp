@@ -1,11 +1,16 @@
 #include "snapdecision/imagedescriptionnode.h"
 
 #include <QDateTime>
+#include <QDir>
 #include <QFileInfo>
 #include <QImageReader>
 #include <QString>
+#include <algorithm>
+#include <array>
 #include <fstream>
+#include <limits>
 #include <iostream>
+#include <utility>
 
 #include "snapdecision/utils.h"
 #include "snapdecision/TinyEXIF.h"
@@ -14,17 +19,77 @@ ImageDescriptionNode::ImageDescriptionNode(NodeType type) : node_type(type)
 {
 }
 
-static bool canOpenImage(const QString& file_path)
+bool ImageDescriptionNode::setDecision(DecisionType d)
 {
-  QImageReader reader(file_path);
-  return reader.canRead();
+  const auto previous = std::exchange(decision, d);
+
+  if (previous == d)
+  {
+    return false;
+  }
+
+  decision_counts.add(previous, -1);
+  decision_counts.add(d, 1);
+
+  for (auto p = parent.lock(); p; p = p->parent.lock())
+  {
+    p->decision_counts.add(previous, -1);
+    p->decision_counts.add(d, 1);
+  }
+
+  return true;
+}
+
+static void adopt(const ImageDescriptionNode::Ptr& parent, const ImageDescriptionNode::Ptr& child)
+{
+  child->parent = parent;
+  for (const auto& grandchild : child->children)
+  {
+    adopt(child, grandchild);
+  }
 }
 
-static std::size_t creationDateInMsSinceEpoch(const QFileInfo& file_info)
+void replaceChildren(const ImageDescriptionNode::Ptr& parent, int row, int count,
+                     const std::vector<ImageDescriptionNode::Ptr>& replacement)
 {
-  QDateTime creation_time = file_info.birthTime();  // or fileInfo.created();
-  qint64 ms_since_epoch = creation_time.toMSecsSinceEpoch();
-  return static_cast<std::size_t>(ms_since_epoch);
+  auto& children = parent->children;
+  const auto at = children.erase(children.begin() + row, children.begin() + row + count);
+  children.insert(at, replacement.begin(), replacement.end());
+
+  // a replacement may hold nodes that were elsewhere in the tree before
+  for (const auto& child : replacement)
+  {
+    adopt(parent, child);
+  }
+}
+
+// Recognizes what cameras and editors write from the first bytes of the file. Anything else is left to
+// QImageReader, which tries its plugins one after the other.
+static bool canOpenImage(const QString& file_path)
+{
+  std::ifstream file(file_path.toStdString(), std::ifstream::in | std::ifstream::binary);
+  if (!file)
+  {
+    return false;
+  }
+
+  std::array<unsigned char, 12> magic{};
+  file.read(reinterpret_cast<char*>(magic.data()), magic.size());
+
+  const auto starts_with = [&magic](std::initializer_list<unsigned char> bytes, std::size_t offset = 0)
+  { return std::equal(bytes.begin(), bytes.end(), magic.begin() + offset); };
+
+  if (starts_with({ 0xFF, 0xD8, 0xFF }) ||                                               // JPEG
+      starts_with({ 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A }) ||                    // PNG
+      starts_with({ 'I', 'I', 0x2A, 0x00 }) || starts_with({ 'M', 'M', 0x00, 0x2A }) ||  // TIFF
+      starts_with({ 'G', 'I', 'F', '8' }) ||                                             // GIF
+      (starts_with({ 'R', 'I', 'F', 'F' }) && starts_with({ 'W', 'E', 'B', 'P' }, 8)))   // WebP
+  {
+    return true;
+  }
+
+  QImageReader reader(file_path);
+  return reader.canRead();
 }
 
 std::optional<TinyEXIF::EXIFInfo> readEXIFData(const std::string& image_path)
@@ -43,64 +108,88 @@ std::optional<TinyEXIF::EXIFInfo> readEXIFData(const std::string& image_path)
   return std::nullopt;
 }
 
-static void populateNodeFromDatabase(const ImageDescriptionNode::Ptr& n, const DatabaseManager::Ptr& db)
+static void populateNodeFromRecord(const ImageDescriptionNode::Ptr& n, const ImageRecord& r)
 {
-  const auto img = n->full_path;
-
-  n->decision = db->getDecision(img).value_or(DecisionType::Unclassified);
-  n->exposure_program = db->getExposureProgram(img).value_or(ExposureProgram::NotDefined);
-  n->metering_mode = db->getMeteringMode(img).value_or(MeteringMode::Unknown);
-  n->time_ms = db->getCreationMs(img).value_or(0);
-  n->make = db->getMake(img).value_or("");
-  n->model = db->getModel(img).value_or("");
-  n->width = db->getImageWidth(img).value_or(0);
-  n->height = db->getImageHeight(img).value_or(0);
-  n->iso = db->getISOSpeedRatings(img).value_or(0);
-  n->f_number = db->getFNumber(img).value_or(0);
-
-  n->shutter_speed = db->getShutterSpeedValue(img).value_or(0);
-  n->exposure_bias = db->getExposureBiasValue(img).value_or(0);
-  n->focal_length = db->getFocalLength(img).value_or(0);
-  n->orientation = db->getOrientation(img).value_or(0);
+  n->exposure_program = r.exposure_program;
+  n->metering_mode = r.metering_mode;
+  n->time_ms = r.creation_ms;
+  n->make = r.make;
+  n->model = r.model;
+  n->width = r.image_width;
+  n->height = r.image_height;
+  n->iso = r.iso_speed_ratings;
+  n->f_number = r.f_number;
+
+  n->shutter_speed = r.exposure_time;
+  n->exposure_bias = r.exposure_bias_value;
+  n->focal_length = r.focal_length;
+  n->orientation = r.orientation;
 
   n->ready = true;  // no more writes from the loading threads
 }
 
-static void doEXIFLookup(const ImageDescriptionNode::Ptr& node, const DatabaseManager::Ptr& database_manager)
+static void doEXIFLookup(const ImageDescriptionNode::Ptr& node, const DatabaseManager::Ptr& database_manager,
+                         FileFingerprint fingerprint, const std::optional<ImageRecord>& stored)
 {
   const auto image_path = node->full_path;
 
+  fingerprint.partial_hash = partialHash(image_path);
+
+  // moved, copied or touched, but what the EXIF data was read from is unchanged
+  if (stored && stored->creation_ms && stored->fingerprint.sameContents(fingerprint))
+  {
+    ImageRecord record = *stored;
+    record.fingerprint = fingerprint;
+    database_manager->queueRecord(record);
+
+    populateNodeFromRecord(node, record);
+    return;
+  }
+
   const auto exif_opt = readEXIFData(image_path);
 
   if (!exif_opt.has_value())
   {
-    database_manager->setCreationMs(image_path, node->time_ms);
-    populateNodeFromDatabase(node, database_manager);
+    ImageRecord record;
+    record.absolute_path = image_path;
+    record.creation_ms = node->time_ms;
+    record.fingerprint = fingerprint;
+    database_manager->queueRecord(record);
+
+    node->ready = true;
     return;
   }
 
   const auto exif = exif_opt.value();
 
-  database_manager->setMake(image_path, exif.Make);
-  database_manager->setModel(image_path, exif.Model);
-  database_manager->setDateTime(image_path, exif.DateTime);
-  database_manager->setDateTimeOriginal(image_path, exif.DateTimeOriginal);
-  database_manager->setSubSecTimeOriginal(image_path, exif.SubSecTimeOriginal);
-  database_manager->setImageWidth(image_path, exif.ImageWidth);
-  database_manager->setImageHeight(image_path, exif.ImageHeight);
-  database_manager->setBitsPerSample(image_path, exif.BitsPerSample);
-  database_manager->setISOSpeedRatings(image_path, exif.ISOSpeedRatings);
-  database_manager->setFNumber(image_path, exif.FNumber);
-  database_manager->setExposureTime(image_path, exif.ExposureTime);
-  database_manager->setApertureValue(image_path, exif.ApertureValue);
-  database_manager->setBrightnessValue(image_path, exif.BrightnessValue);
-  database_manager->setExposureBiasValue(image_path, exif.ExposureBiasValue);
-  database_manager->setSubjectDistance(image_path, exif.SubjectDistance);
-  database_manager->setFocalLength(image_path, exif.FocalLength);
-  database_manager->setOrientation(image_path, exif.Orientation);
-
-  database_manager->setExposureProgram(image_path, static_cast<ExposureProgram>(exif.ExposureProgram));
-  database_manager->setMeteringMode(image_path, static_cast<MeteringMode>(exif.MeteringMode));
+  if (node->image_cache_handle_)
+  {
+    node->image_cache_handle_->setEmbeddedPreview(exif.Thumbnail.Offset, exif.Thumbnail.Length,
+                                                  QSize(exif.ImageWidth, exif.ImageHeight));
+  }
+
+  ImageRecord record;
+  record.absolute_path = image_path;
+  record.make = exif.Make;
+  record.model = exif.Model;
+  record.date_time = exif.DateTime;
+  record.date_time_original = exif.DateTimeOriginal;
+  record.sub_sec_time_original = exif.SubSecTimeOriginal;
+  record.image_width = exif.ImageWidth;
+  record.image_height = exif.ImageHeight;
+  record.bits_per_sample = exif.BitsPerSample;
+  record.iso_speed_ratings = exif.ISOSpeedRatings;
+  record.f_number = exif.FNumber;
+  record.exposure_time = exif.ExposureTime;
+  record.aperture_value = exif.ApertureValue;
+  record.brightness_value = exif.BrightnessValue;
+  record.exposure_bias_value = exif.ExposureBiasValue;
+  record.subject_distance = exif.SubjectDistance;
+  record.focal_length = exif.FocalLength;
+  record.orientation = exif.Orientation;
+
+  record.exposure_program = static_cast<ExposureProgram>(exif.ExposureProgram);
+  record.metering_mode = static_cast<MeteringMode>(exif.MeteringMode);
 
   std::size_t creation_ms = node->time_ms;
 
@@ -111,7 +200,6 @@ static void doEXIFLookup(const ImageDescriptionNode::Ptr& node, const DatabaseMa
     date = exif.DateTime;
   }
 
-  database_manager->setCreationMs(image_path, creation_ms);
   if (!date.empty())
   {
     QString exifTimestamp = QString::fromStdString(date);
@@ -126,72 +214,38 @@ static void doEXIFLookup(const ImageDescriptionNode::Ptr& node, const DatabaseMa
       }
     }
   }
-  database_manager->setCreationMs(image_path, creation_ms);
-
-  populateNodeFromDatabase(node, database_manager);
-}
-
-static void scheduleEXIFLookup(const ImageDescriptionNode::Ptr& node, const TaskQueue::Ptr& task_queue,
-                               const DatabaseManager::Ptr& database_manager, const SimpleFunction& on_finish)
-{
-  ImageDescriptionNode::WeakPtr weak_node = node;
-  DatabaseManager::WeakPtr weak_db = database_manager;
+  record.creation_ms = creation_ms;
+  record.fingerprint = fingerprint;
 
-  const auto worker_function = [weak_node, weak_db, on_finish](double& progress)
-  {
-    progress = 0.0;
+  database_manager->queueRecord(record);
 
-    if (const auto& node = weak_node.lock())
-    {
-      if (const auto& db = weak_db.lock())
-      {
-        doEXIFLookup(node, db);
-        populateNodeFromDatabase(node, db);
-      }
-    }
-    on_finish();
-    progress = 1.0;
-  };
-
-  task_queue->submit(worker_function);
+  populateNodeFromRecord(node, record);
 }
 
-static void scheduleDbLookup(const ImageDescriptionNode::Ptr& node, const TaskQueue::Ptr& task_queue,
-                             const DatabaseManager::Ptr& database_manager, const SimpleFunction& on_finish)
+static void scheduleEXIFLookup(const ImageDescriptionNode::Ptr& node, const TaskQueue::Ptr& task_queue,
+                               const DatabaseManager::Ptr& database_manager, const FileFingerprint& fingerprint,
+                               const std::optional<ImageRecord>& stored, const NodeFunction& on_ready, int priority)
 {
   ImageDescriptionNode::WeakPtr weak_node = node;
   DatabaseManager::WeakPtr weak_db = database_manager;
 
-  const auto worker_function = [weak_node, weak_db, on_finish](double& progress)
+  const auto worker_function = [weak_node, weak_db, fingerprint, stored, on_ready](double& progress)
   {
     progress = 0.0;
 
-    if (const auto& node = weak_node.lock())
+    const auto node = weak_node.lock();
+    if (node)
     {
       if (const auto& db = weak_db.lock())
       {
-        populateNodeFromDatabase(node, db);
+        doEXIFLookup(node, db, fingerprint, stored);
       }
     }
-    on_finish();
+    on_ready(node);
     progress = 1.0;
   };
 
-  task_queue->submit(worker_function);
-}
-
-static void populateExifInfo(const ImageDescriptionNode::Ptr& node, const TaskQueue::Ptr& task_queue,
-                             const DatabaseManager::Ptr& database_manager, const SimpleFunction& on_finish)
-{
-  const auto db_time = database_manager->getCreationMs(node->full_path);
-
-  if (db_time)  // then we have data on-hand
-  {
-    scheduleDbLookup(node, task_queue, database_manager, on_finish);
-    return;
-  }
-
-  scheduleEXIFLookup(node, task_queue, database_manager, on_finish);
+  task_queue->submit(worker_function, priority);
 }
 
 std::string getExtension(const std::string& filePath)
@@ -212,61 +266,101 @@ bool isMostlyUpperCase(const std::string& str)
   return counter > 0;
 }
 
-std::string findRawImage(const std::string& file_path)
+// common raw file extensions, the earlier one wins when a frame has several
+static const QStringList raw_extensions = { "raw", "cr3", "cr2", "nef", "arw", "raf",
+                                            "orf", "dng", "rw2", "pef", "srw" };
+
+static bool isRawExtension(const QString& extension)
 {
-  QString q_file_path = QString::fromStdString(file_path);
-  QFileInfo file_info(q_file_path);
-  QDir directory = file_info.dir();
-  QString base_name = file_info.completeBaseName();
+  return raw_extensions.contains(extension.toLower());
+}
 
-  const auto ext = getExtension(file_path);
+// "/the/full/path/IMG_0001.JPG" -> "/the/full/path/img_0001", the files of a frame share it whatever
+// the case of their names
+static std::string frameKey(const QFileInfo& file_info)
+{
+  return (file_info.absolutePath() + "/" + file_info.completeBaseName()).toLower().toStdString();
+}
 
-  const bool prefer_upper = isMostlyUpperCase(ext);
+SiblingIndex::SiblingIndex(const FileStats& file_stats)
+{
+  for (const auto& [path, stat] : file_stats)
+  {
+    frames_[frameKey(QFileInfo(QString::fromStdString(path)))].push_back(path);
+  }
+}
+
+std::string SiblingIndex::rawFor(const std::string& image_path) const
+{
+  const QFileInfo file_info(QString::fromStdString(image_path));
 
-  const auto getCandidates = [&](const auto& ext)
+  const auto frame = frames_.find(frameKey(file_info));
+  if (frame == frames_.end())
   {
-    QString potential_file_lower = directory.filePath(base_name + "." + ext.toLower());
-    QString potential_file_upper = directory.filePath(base_name + "." + ext.toUpper());
+    return "";
+  }
+
+  // where both cases exist the one matching the image's extension is taken
+  const bool prefer_upper = isMostlyUpperCase(file_info.suffix().toStdString());
+
+  std::string raw_path;
+  int best_rank = std::numeric_limits<int>::max();
 
-    QStringList files_to_check;
-    if (prefer_upper)
+  for (const auto& sibling : frame->second)
+  {
+    const QString extension = QFileInfo(QString::fromStdString(sibling)).suffix();
+    const auto index = raw_extensions.indexOf(extension.toLower());
+    if (index < 0)
     {
-      files_to_check << potential_file_upper << potential_file_lower;
+      continue;
     }
-    else
+
+    const bool case_matches = isMostlyUpperCase(extension.toStdString()) == prefer_upper;
+    const int rank = 2 * static_cast<int>(index) + (case_matches ? 0 : 1);
+    if (rank < best_rank)
     {
-      files_to_check << potential_file_lower << potential_file_upper;
+      best_rank = rank;
+      raw_path = sibling;
     }
-    return files_to_check;
-  };
+  }
 
-  // List of common raw file extensions
-  QStringList raw_extensions = { "raw", "cr3", "cr2", "nef", "arw", "raf", "orf", "dng", "rw2", "pef", "srw" };
+  return raw_path;
+}
 
-  for (const QString& ext : raw_extensions)
+std::vector<std::string> SiblingIndex::rawOnly() const
+{
+  std::vector<std::string> raw_paths;
+
+  for (const auto& [key, files] : frames_)
   {
-    for (const auto& file : getCandidates(ext))
+    const bool all_raw = std::all_of(files.begin(), files.end(), [](const std::string& file)
+                                     { return isRawExtension(QFileInfo(QString::fromStdString(file)).suffix()); });
+    if (all_raw)
     {
-      if (QFileInfo::exists(file))
-      {
-        return file.toStdString();
-      }
+      raw_paths.insert(raw_paths.end(), files.begin(), files.end());
     }
   }
 
-  return "";
+  return raw_paths;
+}
+
+std::string folderDatabasePath(const std::string& directory)
+{
+  return QDir(QString::fromStdString(directory)).absolutePath().toStdString() + "/.image_database.db";
 }
 
 ImageDescriptionNode::Ptr buildImageDescriptionNode(const std::string& filename, const ImageCache::Ptr& image_cache,
                                                     const TaskQueue::Ptr& task_queue,
                                                     const DatabaseManager::Ptr& database_manager,
-                                                    const SimpleFunction& on_finish)
+                                                    const StoredImages& stored_images, const FileStats& file_stats,
+                                                    const SiblingIndex& siblings, const NodeFunction& on_ready,
+                                                    int priority)
 {
   const auto q_filename = QString::fromStdString(filename);
 
   if (!canOpenImage(q_filename))
   {
-    on_finish();
+    on_ready(nullptr);
     return nullptr;
   }
 
@@ -276,25 +370,37 @@ ImageDescriptionNode::Ptr buildImageDescriptionNode(const std::string& filename,
   node->filename = file_info.fileName().toStdString();
 
   node->full_path = file_info.absoluteFilePath().toStdString();
-  node->full_raw_path = findRawImage(node->full_path);
+  node->full_raw_path = siblings.rawFor(node->full_path);
   node->raw_path_extension = getExtension(node->full_raw_path);
 
   node->image_cache_handle_ = image_cache->getHandle(node->full_path);
 
-  const auto parent_path = file_info.absolutePath().toStdString();
+  // the sweep saw nearly every file, only one that appeared since needs a stat of its own
+  const auto swept = file_stats.find(node->full_path);
+  const FileStat file_stat = swept != file_stats.end() ? swept->second : statFile(file_info);
 
-  const auto db_path = parent_path + "/.image_database.db";
+  node->time_ms = file_stat.birth_ms;
 
-  if (database_manager->getLocation() != db_path)
+  const auto stored = stored_images.find(node->full_path);
+
+  std::optional<ImageRecord> stored_record;
+
+  if (stored != stored_images.end())
   {
-    database_manager->switchToFileBased(db_path);
-  }
+    node->decision = stored->second.decision;
 
-  node->decision = database_manager->getDecision(node->full_path).value_or(DecisionType::Unclassified);
+    // the data on hand is only used while the file is the one it was read from
+    if (stored->second.record.creation_ms && stored->second.record.fingerprint.sameStat(file_stat.fingerprint))
+    {
+      populateNodeFromRecord(node, stored->second.record);
+      on_ready(node);
+      return node;
+    }
 
-  node->time_ms = creationDateInMsSinceEpoch(file_info);
+    stored_record = stored->second.record;
+  }
 
-  populateExifInfo(node, task_queue, database_manager, on_finish);
+  scheduleEXIFLookup(node, task_queue, database_manager, file_stat.fingerprint, stored_record, on_ready, priority);
 
   return node;
 }
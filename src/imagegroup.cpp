@@ -1,10 +1,38 @@
 #include "snapdecision/imagegroup.h"
 
+#include <QDateTime>
+#include <QDir>
+#include <algorithm>
 #include <optional>
+#include <utility>
+#include <unordered_set>
+
+constexpr int ingest_priority = 0;  // behind showing and prefetching, culling goes on while a folder streams in
+constexpr std::size_t ingest_chunk_size = 32;        // files per node building task
+constexpr std::size_t max_images_in_flight = 1024;   // handed out and waiting for their time
+constexpr std::size_t resume_images_in_flight = 512;  // the walk goes on once this few are left
+constexpr int sweep_delay_ms = 250;                  // quiet time after a change before a sweep
+constexpr qint64 settle_ms = 1000;  // a file has to look the same for this long before it is ingested
 
 ImageGroup::ImageGroup()
 {
-  connect(this, &ImageGroup::fileListLoadComplete, this, &ImageGroup::onFileListLoadComplete);
+  connect(this, &ImageGroup::nodesReady, this, &ImageGroup::onNodesReady);
+
+  sweep_timer_.setSingleShot(true);
+  sweep_timer_.setInterval(sweep_delay_ms);
+
+  // every event restarts the timer, as does a sweep that found files still being written
+  const auto directory_changed = [this](const QString& directory)
+  {
+    changed_directories_.insert(directory);
+    sweep_timer_.start();
+  };
+  connect(&watcher_, &QFileSystemWatcher::directoryChanged, this, directory_changed);
+  connect(this, &ImageGroup::watchedDirectoryChanged, this, directory_changed);
+  connect(this, &ImageGroup::directoriesFound, this, [this](const QStringList& directories) {
+    watcher_.addPaths(directories);
+  });
+  connect(&sweep_timer_, &QTimer::timeout, this, &ImageGroup::sweepWatchedFolder);
 }
 
 static ImageDescriptionNode::Ptr buildTree(const std::vector<ImageDescriptionNode::Ptr>& images, TimeMs sceneThreshold,
@@ -74,31 +102,785 @@ static void simplifyTree(const ImageDescriptionNode::Ptr& node)
   }
 }
 
-void ImageGroup::loadFiles(const std::vector<std::string>& filenames, const ImageCache::Ptr& image_cache,
-                           const TaskQueue::Ptr& task_queue, const DatabaseManager::Ptr& database_manager,
-                           const DiagnosticFunction& diagnostic_function)
+static const DecisionCounts& recountDecisions(const ImageDescriptionNode::Ptr& node)
 {
-  const auto on_finish = [this]() { this->adjustWorkLeft(-1); };
+  node->decision_counts = DecisionCounts{};
+
+  if (node->node_type == NodeType::Image)
+  {
+    node->decision_counts.add(node->decision, 1);
+  }
+
+  for (const auto& child : node->children)
+  {
+    node->decision_counts += recountDecisions(child);
+  }
 
-  database_manager->close();
+  return node->decision_counts;
+}
+
+void ImageGroup::loadFolder(const QString& directory, const QStringList& name_filters,
+                            const ImageCache::Ptr& image_cache, const TaskQueue::Ptr& task_queue,
+                            const DatabaseManager::Ptr& database_manager, const DiagnosticFunction& diagnostic_function)
+{
+  const int generation = ++load_generation_;
+
+  // the old folder's nodes go, and with them the EXIF lookups still queued for them
+  {
+    std::lock_guard lock(load_mutex_);
+    ingests_.clear();
+    ready_nodes_.clear();
+    gone_paths_.clear();
+  }
+
+  sweep_timer_.stop();
+  changed_directories_.clear();
+  if (const auto watched = watcher_.directories(); !watched.isEmpty())
+  {
+    watcher_.removePaths(watched);
+  }
+  watcher_.addPath(directory);
 
-  adjustWorkLeft(filenames.size());
+  const Settings settings = get_settings_();
+  watch_ = Watch{ name_filters, settings.delete_foler_name_, image_cache, task_queue, database_manager,
+                  diagnostic_function };
 
   flat_list_.clear();
-  for (const auto& filename : filenames)
+  map_.clear();
+  tree_root_ = std::make_shared<ImageDescriptionNode>(NodeType::Root);
+
+  emit treeCleared();
+
+  // Every image goes into one database, the catalog or the folder's own. Both are keyed by directory.
+  const auto catalog = settings.catalog_database_path_.toStdString();
+  const auto database_path = catalog.empty() ? folderDatabasePath(directory.toStdString()) : catalog;
+
+  auto walk = std::make_shared<Walk>();
+  walk->generation = generation;
+  walk->watch = watch_;
+  walk->directories = { QDir(directory).absolutePath().toStdString() };
+  walk->producing = true;
+
+  // the walk is a unit of work until it has visited every directory
+  adjustWorkLeft(1);
+
+  // Switching databases and walking the folders all happen on the task queue, the GUI thread only puts
+  // the nodes into the tree in onNodesReady().
+  task_queue->submit(
+      [this, walk, database_path](double& progress)
+      {
+        std::lock_guard switch_lock(database_switch_mutex_);
+
+        if (walk->generation != load_generation_)
+        {
+          finishWalk(walk);
+          return;
+        }
+
+        // copying the old rows into the folder's database can take a while
+        walk->watch.database_manager->close();
+        walk->watch.database_manager->switchToFileBased(database_path,
+                                                        [this, &progress](double fraction)
+                                                        {
+                                                          progress = fraction;
+                                                          emit databaseOpenProgress(fraction);
+                                                        });
+
+        watched_directories_.clear();
+        watched_generation_ = walk->generation;
+
+        continueWalk(walk);
+      },
+      ingest_priority);
+}
+
+void ImageGroup::continueWalk(const std::shared_ptr<Walk>& walk)
+{
+  for (;;)
   {
-    const auto node = buildImageDescriptionNode(filename, image_cache, task_queue, database_manager, on_finish);
-    if (node)
     {
-      flat_list_.push_back(node);
+      std::lock_guard lock(walk->mutex);
+
+      if (walk->generation != load_generation_)
+      {
+        break;
+      }
+
+      // picked up again from imageDone()
+      if (walk->in_flight >= max_images_in_flight)
+      {
+        walk->producing = false;
+        return;
+      }
+    }
+
+    if (!walk->current || walk->next == walk->current->filenames.size())
+    {
+      walk->current.reset();
+
+      if (walk->directories.empty())
+      {
+        break;
+      }
+
+      const auto directory = std::move(walk->directories.back());
+      walk->directories.pop_back();
+
+      walk->current = visitDirectory(*walk, directory);
+      walk->next = 0;
+      continue;
+    }
+
+    const auto ingest = walk->current;
+    const std::size_t begin = walk->next;
+    const std::size_t end = std::min(begin + ingest_chunk_size, ingest->filenames.size());
+    walk->next = end;
+
+    {
+      std::lock_guard lock(walk->mutex);
+      walk->in_flight += end - begin;
     }
+
+    // a node is queued for the tree before its unit of work is done, so the tree is complete by the
+    // time fileListLoadComplete() is emitted
+    adjustWorkLeft(static_cast<int>(end - begin));
+
+    // submitted from a worker these land on its own deque, idle workers steal them from there
+    walk->watch.task_queue->submit(
+        [this, walk, ingest, begin, end](double&)
+        {
+          const auto on_ready = [this, walk, weak_ingest = std::weak_ptr<Ingest>(ingest),
+                                 generation = ingest->generation](const ImageDescriptionNode::Ptr& node)
+          {
+            if (node)
+            {
+              this->queueReadyNode(generation, node);
+            }
+
+            // the nodes are queued for the tree or gone, the ingest no longer needs to keep them
+            if (const auto ingest = weak_ingest.lock(); ingest && --ingest->nodes_left == 0)
+            {
+              std::lock_guard lock(load_mutex_);
+              std::erase(ingests_, ingest);
+            }
+
+            this->imageDone(walk);
+            this->adjustWorkLeft(-1);
+          };
+
+          const auto& watch = walk->watch;
+          for (std::size_t i = begin; i < end; ++i)
+          {
+            ingest->nodes[i] = buildImageDescriptionNode(ingest->filenames[i], watch.image_cache, watch.task_queue,
+                                                         watch.database_manager, ingest->stored_images,
+                                                         ingest->file_stats, ingest->siblings, on_ready,
+                                                         ingest_priority);
+          }
+        },
+        ingest_priority);
   }
 
-  map_.clear();
-  for (const auto& node : flat_list_)
+  finishWalk(walk);
+}
+
+void ImageGroup::finishWalk(const std::shared_ptr<Walk>& walk)
+{
+  {
+    std::lock_guard lock(walk->mutex);
+    walk->producing = false;
+    if (std::exchange(walk->finished, true))
+    {
+      return;
+    }
+  }
+
+  walk->current.reset();
+  walk->directories.clear();
+
+  adjustWorkLeft(-1);
+}
+
+void ImageGroup::imageDone(const std::shared_ptr<Walk>& walk)
+{
   {
+    std::lock_guard lock(walk->mutex);
+    walk->in_flight--;
+
+    if (walk->producing || walk->finished || walk->in_flight > resume_images_in_flight)
+    {
+      return;
+    }
+    walk->producing = true;
+  }
+
+  walk->watch.task_queue->submit(
+      [this, walk](double&)
+      {
+        std::lock_guard switch_lock(database_switch_mutex_);
+        continueWalk(walk);
+      },
+      ingest_priority);
+}
+
+std::shared_ptr<ImageGroup::Ingest> ImageGroup::visitDirectory(Walk& walk, const std::string& directory)
+{
+  const auto& watch = walk.watch;
+  const QDir dir(QString::fromStdString(directory));
+
+  // Its parent's listing tells a renamed folder from one that is briefly away. A folder that is gone with
+  // no watched parent, the loaded one, is more likely unmounted than emptied, what is shown of it stays.
+  if (!dir.exists())
+  {
+    return nullptr;
+  }
+
+  auto& watched = watched_directories_[directory];
+  const bool first_visit = watched.files.empty() && watched.subdirectories.empty();
+
+  // Subdirectories that are new get walked like the folder was. Depth first, in name order.
+  std::set<std::string> subdirectories;
+  QStringList found;
+  for (const auto& name : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDir::Name))
+  {
+    if (name != watch.excluded_name)
+    {
+      subdirectories.insert(dir.absoluteFilePath(name).toStdString());
+    }
+  }
+
+  std::vector<std::string> to_visit;
+  for (const auto& subdirectory : subdirectories)
+  {
+    if (!watched.subdirectories.contains(subdirectory))
+    {
+      to_visit.push_back(subdirectory);
+      found.push_back(QString::fromStdString(subdirectory));
+    }
+  }
+  std::sort(to_visit.begin(), to_visit.end());
+  walk.directories.insert(walk.directories.end(), to_visit.rbegin(), to_visit.rend());
+
+  // Renamed, moved or deleted. Its images leave the tree, a renamed folder shows up as a new one.
+  for (const auto& subdirectory : watched.subdirectories)
+  {
+    if (!subdirectories.contains(subdirectory))
+    {
+      forgetDirectory(walk.generation, subdirectory);
+    }
+  }
+
+  if (!found.isEmpty())
+  {
+    emit directoriesFound(found);
+  }
+
+  auto ingest = std::make_shared<Ingest>();
+  ingest->generation = walk.generation;
+
+  std::vector<std::string> images;
+  for (const auto& name : dir.entryList(watch.name_filters, QDir::Files, QDir::Name))
+  {
+    images.push_back(dir.absoluteFilePath(name).toStdString());
+  }
+
+  // one listing per directory instead of a stat per image, to tell which rows are still current
+  ingest->file_stats = statDirectories(images);
+
+  // the same listing pairs images with their RAW files
+  ingest->siblings = SiblingIndex(ingest->file_stats);
+
+  if (const auto raw_only = ingest->siblings.rawOnly(); first_visit && !raw_only.empty())
+  {
+    watch.diagnostic_function(LogLevel::Info, std::to_string(raw_only.size()) + " RAW files in " + directory +
+                                                  " have no image to show them with.");
+  }
+
+  const auto now_ms = QDateTime::currentMSecsSinceEpoch();
+
+  std::unordered_map<std::string, WatchedFile> files;
+  std::unordered_map<std::string, PendingFile> pending;
+  for (const auto& image : images)
+  {
+    const auto stat = ingest->file_stats.find(image);
+    if (stat == ingest->file_stats.end())
+    {
+      continue;  // gone again since the listing
+    }
+
+    const WatchedFile current{ stat->second.fingerprint, ingest->siblings.rawFor(image) };
+    const auto known = watched.files.find(image);
+
+    // a RAW file arriving after its image changes what the image is shown with
+    if (known != watched.files.end() && known->second.fingerprint.sameStat(current.fingerprint) &&
+        known->second.raw_path == current.raw_path)
+    {
+      files.insert(*known);
+      continue;
+    }
+
+    // Possibly half copied, only ingested once sweeps at least settle_ms apart found it unchanged. The
+    // modification time is no help, offloaders often keep the one the camera wrote.
+    if (walk.settle)
+    {
+      const auto seen = watched.pending.find(image);
+      const bool unchanged = seen != watched.pending.end() &&
+                             seen->second.file.fingerprint.sameStat(current.fingerprint) &&
+                             seen->second.file.raw_path == current.raw_path;
+      if (!unchanged || now_ms - seen->second.seen_ms < settle_ms)
+      {
+        pending.emplace(image, unchanged ? seen->second : PendingFile{ current, now_ms });
+        if (known != watched.files.end())
+        {
+          files.insert(*known);
+        }
+        continue;
+      }
+    }
+
+    files.emplace(image, current);
+    ingest->filenames.push_back(image);
+  }
+
+  // Only taken out of the tree, the rows keep their votes. A file saved through a rename or moved back
+  // is matched with its row again by its fingerprint.
+  std::size_t gone = 0;
+  for (const auto& [image, file] : watched.files)
+  {
+    if (!files.contains(image))
+    {
+      queueGonePath(walk.generation, image);
+      gone++;
+    }
+  }
+
+  if (!first_visit && (!ingest->filenames.empty() || gone > 0))
+  {
+    watch.diagnostic_function(LogLevel::Info, std::to_string(ingest->filenames.size()) + " new or changed and " +
+                                                  std::to_string(gone) + " removed images in " + directory);
+  }
+
+  // looked at again until nothing is pending, the watcher stays quiet once the writes stop
+  if (!pending.empty())
+  {
+    emit watchedDirectoryChanged(QString::fromStdString(directory));
+  }
+
+  watched.files.swap(files);
+  watched.pending.swap(pending);
+  watched.subdirectories.swap(subdirectories);
+
+  if (ingest->filenames.empty())
+  {
+    return nullptr;
+  }
+
+  // one scan per directory instead of a round of queries per image
+  ingest->stored_images = watch.database_manager->loadRecordsFor(ingest->filenames);
+  ingest->nodes.resize(ingest->filenames.size());
+  ingest->nodes_left = ingest->filenames.size();
+
+  {
+    std::lock_guard lock(load_mutex_);
+    if (walk.generation != load_generation_)
+    {
+      return nullptr;
+    }
+    ingests_.push_back(ingest);
+  }
+
+  return ingest;
+}
+
+void ImageGroup::sweepWatchedFolder()
+{
+  if (changed_directories_.empty() || !watch_.task_queue)
+  {
+    return;
+  }
+
+  // Only the changed directories are listed, the images that are new or changed since they were last
+  // looked at are ingested like a load does and those that are gone are taken out. Nothing else is touched.
+  auto walk = std::make_shared<Walk>();
+  walk->generation = load_generation_;
+  walk->watch = watch_;
+  walk->settle = true;
+  for (const auto& directory : changed_directories_)
+  {
+    walk->directories.push_back(QDir(directory).absolutePath().toStdString());
+  }
+  changed_directories_.clear();
+  walk->producing = true;
+
+  adjustWorkLeft(1);
+
+  watch_.task_queue->submit(
+      [this, walk](double&)
+      {
+        std::lock_guard switch_lock(database_switch_mutex_);
+
+        // before the load has opened the database there is nothing to compare with, the load sees the change
+        if (walk->generation != watched_generation_)
+        {
+          finishWalk(walk);
+          return;
+        }
+
+        continueWalk(walk);
+      },
+      ingest_priority);
+}
+
+void ImageGroup::queueReadyNode(int generation, const ImageDescriptionNode::Ptr& node)
+{
+  bool first = false;
+  {
+    std::lock_guard lock(load_mutex_);
+
+    if (generation != load_generation_)
+    {
+      return;
+    }
+
+    first = ready_nodes_.empty() && gone_paths_.empty();
+    ready_nodes_.push_back(node);
+  }
+
+  if (first)
+  {
+    emit nodesReady();
+  }
+}
+
+void ImageGroup::forgetDirectory(int generation, const std::string& directory)
+{
+  const auto it = watched_directories_.find(directory);
+  if (it == watched_directories_.end())
+  {
+    return;
+  }
+
+  // only the nodes go, the rows keep their votes for when the images turn up again
+  const WatchedDirectory watched = std::move(it->second);
+  watched_directories_.erase(it);
+
+  for (const auto& [image, file] : watched.files)
+  {
+    queueGonePath(generation, image);
+  }
+  for (const auto& subdirectory : watched.subdirectories)
+  {
+    forgetDirectory(generation, subdirectory);
+  }
+}
+
+void ImageGroup::queueGonePath(int generation, const std::string& full_path)
+{
+  bool first = false;
+  {
+    std::lock_guard lock(load_mutex_);
+
+    if (generation != load_generation_)
+    {
+      return;
+    }
+
+    first = ready_nodes_.empty() && gone_paths_.empty();
+    gone_paths_.push_back(full_path);
+  }
+
+  if (first)
+  {
+    emit nodesReady();
+  }
+}
+
+void ImageGroup::onNodesReady()
+{
+  std::vector<ImageDescriptionNode::Ptr> nodes;
+  std::vector<std::string> gone_paths;
+  {
+    std::lock_guard lock(load_mutex_);
+    nodes.swap(ready_nodes_);
+    gone_paths.swap(gone_paths_);
+  }
+
+  if ((nodes.empty() && gone_paths.empty()) || !tree_root_)
+  {
+    return;
+  }
+
+  // a changed image replaces the node it was shown with
+  std::vector<ImageDescriptionNode::Ptr> removed;
+  for (const auto& node : nodes)
+  {
+    if (const auto it = map_.find(node->full_path); it != map_.end() && it->second && it->second != node)
+    {
+      removed.push_back(it->second);
+    }
     map_[node->full_path] = node;
   }
+
+  for (const auto& path : gone_paths)
+  {
+    if (const auto it = map_.find(path); it != map_.end())
+    {
+      if (it->second)
+      {
+        removed.push_back(it->second);
+      }
+      map_.erase(it);
+    }
+  }
+
+  updateTree(std::move(nodes), removed);
+
+  emit treeUpdated();
+}
+
+void ImageGroup::updateTree(std::vector<ImageDescriptionNode::Ptr> added,
+                            const std::vector<ImageDescriptionNode::Ptr>& removed)
+{
+  const Settings& settings = get_settings_();
+
+  // Gone ones first, in time order. While one is taken out the next image is still shown, the one before it
+  // is the last that stays.
+  if (!removed.empty())
+  {
+    const std::unordered_set<ImageDescriptionNode::Ptr> removed_set(removed.begin(), removed.end());
+
+    ImageDescriptionNode::Ptr kept;
+    for (std::size_t i = 0; i < flat_list_.size(); i++)
+    {
+      if (!removed_set.contains(flat_list_[i]))
+      {
+        kept = flat_list_[i];
+        continue;
+      }
+      removeFromTree(flat_list_[i], kept, i + 1 < flat_list_.size() ? flat_list_[i + 1] : nullptr, settings);
+    }
+
+    std::erase_if(flat_list_, [&removed_set](const auto& node) { return removed_set.contains(node); });
+  }
+
+  const auto by_time = [](const auto& a, const auto& b) { return a->time_ms < b->time_ms; };
+
+  // images already in the tree go first among equal times, as if each new one was inserted after them
+  std::stable_sort(added.begin(), added.end(), by_time);
+
+  ImageDescriptionNode::Ptr previous;
+  std::size_t previous_position = 0;
+  for (const auto& node : added)
+  {
+    const auto position =
+        static_cast<std::size_t>(std::upper_bound(flat_list_.begin(), flat_list_.end(), node, by_time) - flat_list_.begin());
+
+    // the one put in just before may have landed between the same two images
+    const auto before = previous && previous_position == position ? previous
+                        : position > 0                              ? flat_list_[position - 1]
+                                                                    : nullptr;
+    const auto after = position < flat_list_.size() ? flat_list_[position] : nullptr;
+
+    insertIntoTree(node, before, after, settings);
+
+    previous = node;
+    previous_position = position;
+  }
+
+  const auto old_size = static_cast<std::ptrdiff_t>(flat_list_.size());
+  flat_list_.insert(flat_list_.end(), added.begin(), added.end());
+  std::inplace_merge(flat_list_.begin(), flat_list_.begin() + old_size, flat_list_.end(), by_time);
+}
+
+// How far apart two images next to each other in time are, as buildTree() tells them apart: 0 in one burst,
+// 1 in one location, 2 further. Nothing before the first or after the last image counts as far.
+static int separation(const ImageDescriptionNode::Ptr& earlier, const ImageDescriptionNode::Ptr& later,
+                      const Settings& settings)
+{
+  if (!earlier || !later)
+  {
+    return 2;
+  }
+
+  const TimeMs gap = later->time_ms - earlier->time_ms;
+  return gap > settings.location_theshold_ms_ ? 2 : gap > settings.burst_threshold_ms_ ? 1 : 0;
+}
+
+// the child of a location an image is shown under, its burst or the image itself
+static ImageDescriptionNode::Ptr itemOf(const ImageDescriptionNode::Ptr& image)
+{
+  const auto parent = image->parent.lock();
+  return parent->node_type == NodeType::Scene ? parent : image;
+}
+
+static ImageDescriptionNode::Ptr locationOf(const ImageDescriptionNode::Ptr& image)
+{
+  return itemOf(image)->parent.lock();
+}
+
+static std::vector<ImageDescriptionNode::Ptr> imagesOf(const ImageDescriptionNode::Ptr& item)
+{
+  return item->node_type == NodeType::Scene ? item->children : std::vector<ImageDescriptionNode::Ptr>{ item };
+}
+
+static int rowOf(const ImageDescriptionNode::Ptr& parent, const ImageDescriptionNode::Ptr& child)
+{
+  return static_cast<int>(std::find(parent->children.begin(), parent->children.end(), child) - parent->children.begin());
+}
+
+// a burst of the images with its tallies, or the image alone as simplifyTree() leaves it
+static ImageDescriptionNode::Ptr makeItem(std::vector<ImageDescriptionNode::Ptr> images)
+{
+  if (images.size() == 1)
+  {
+    return images.front();
+  }
+
+  auto scene = std::make_shared<ImageDescriptionNode>(NodeType::Scene);
+  scene->children = std::move(images);
+  recountDecisions(scene);
+  return scene;
+}
+
+static void addToTallies(ImageDescriptionNode::Ptr node, DecisionType decision, int delta)
+{
+  for (; node; node = node->parent.lock())
+  {
+    node->decision_counts.add(decision, delta);
+  }
+}
+
+void ImageGroup::insertIntoTree(const ImageDescriptionNode::Ptr& image, const ImageDescriptionNode::Ptr& before,
+                                const ImageDescriptionNode::Ptr& after, const Settings& settings)
+{
+  image->decision_counts = DecisionCounts{};
+  image->decision_counts.add(image->decision, 1);
+
+  const int gap_before = separation(before, image, settings);
+  const int gap_after = separation(image, after, settings);
+
+  ImageDescriptionNode::Ptr tallied;  // made for the image, counted with it already
+
+  if (gap_before == 2 && gap_after == 2)
+  {
+    tallied = std::make_shared<ImageDescriptionNode>(NodeType::Location);
+    tallied->children = { image };
+    recountDecisions(tallied);
+
+    replace_children_(tree_root_, before ? rowOf(tree_root_, locationOf(before)) + 1 : 0, 0, { tallied });
+  }
+  else
+  {
+    // an image filling the gap between two locations joins them
+    if (gap_before < 2 && gap_after < 2 && locationOf(before) != locationOf(after))
+    {
+      const auto joined = locationOf(before);
+      const auto gone = locationOf(after);
+      const auto children = gone->children;
+
+      replace_children_(tree_root_, rowOf(tree_root_, gone), 1, {});
+      replace_children_(joined, static_cast<int>(joined->children.size()), 0, children);
+      joined->decision_counts += gone->decision_counts;
+    }
+
+    const auto location = gap_before < 2 ? locationOf(before) : locationOf(after);
+    const auto item_before = gap_before < 2 ? itemOf(before) : nullptr;
+    const auto item_after = gap_after < 2 ? itemOf(after) : nullptr;
+    const bool join_before = gap_before == 0;
+    const bool join_after = gap_after == 0;
+
+    if (join_before && join_after && item_before == item_after)
+    {
+      replace_children_(item_before, rowOf(item_before, before) + 1, 0, { image });
+    }
+    else if (join_before && !join_after && item_before->node_type == NodeType::Scene)
+    {
+      replace_children_(item_before, static_cast<int>(item_before->children.size()), 0, { image });
+    }
+    else if (join_after && !join_before && item_after->node_type == NodeType::Scene)
+    {
+      replace_children_(item_after, 0, 0, { image });
+    }
+    else if (join_before || join_after)
+    {
+      // a burst of the image and the lone images or bursts next to it
+      auto images = join_before ? imagesOf(item_before) : std::vector<ImageDescriptionNode::Ptr>{};
+      images.push_back(image);
+      if (join_after)
+      {
+        const auto images_after = imagesOf(item_after);
+        images.insert(images.end(), images_after.begin(), images_after.end());
+      }
+
+      const int row = rowOf(location, join_before ? item_before : item_after);
+      tallied = makeItem(std::move(images));
+      replace_children_(location, row, static_cast<int>(join_before) + static_cast<int>(join_after), { tallied });
+    }
+    else
+    {
+      replace_children_(location, item_before ? rowOf(location, item_before) + 1 : rowOf(location, item_after), 0,
+                        { image });
+    }
+  }
+
+  addToTallies(tallied ? tallied->parent.lock() : image->parent.lock(), image->decision, 1);
+}
+
+void ImageGroup::removeFromTree(const ImageDescriptionNode::Ptr& image, const ImageDescriptionNode::Ptr& before,
+                                const ImageDescriptionNode::Ptr& after, const Settings& settings)
+{
+  const auto parent = image->parent.lock();
+  const auto location = locationOf(image);
+
+  addToTallies(parent, image->decision, -1);
+
+  if (parent->node_type == NodeType::Scene)
+  {
+    const int row = rowOf(parent, image);
+    const int scene_row = rowOf(location, parent);
+
+    if (before && after && before->parent.lock() == parent && after->parent.lock() == parent &&
+        separation(before, after, settings) > 0)
+    {
+      // the burst falls apart where the image was
+      const auto& images = parent->children;
+      replace_children_(location, scene_row, 1,
+                        { makeItem(std::vector<ImageDescriptionNode::Ptr>(images.begin(), images.begin() + row)),
+                          makeItem(std::vector<ImageDescriptionNode::Ptr>(images.begin() + row + 1, images.end())) });
+    }
+    else if (parent->children.size() > 2)
+    {
+      replace_children_(parent, row, 1, {});
+    }
+    else
+    {
+      replace_children_(location, scene_row, 1, { parent->children[1 - row] });
+    }
+  }
+  else
+  {
+    replace_children_(location, rowOf(location, image), 1, {});
+
+    if (location->children.empty())
+    {
+      replace_children_(tree_root_, rowOf(tree_root_, location), 1, {});
+      return;
+    }
+  }
+
+  // and so does the location
+  if (separation(before, after, settings) == 2 && before && after && locationOf(before) == location &&
+      locationOf(after) == location)
+  {
+    const int row = rowOf(location, itemOf(after));
+
+    auto split = std::make_shared<ImageDescriptionNode>(NodeType::Location);
+    split->children.assign(location->children.begin() + row, location->children.end());
+    recountDecisions(split);
+
+    replace_children_(location, row, static_cast<int>(split->children.size()), {});
+    replace_children_(tree_root_, rowOf(tree_root_, location) + 1, 0, { split });
+    location->decision_counts -= split->decision_counts;
+  }
 }
 
 ImageDescriptionNode::Ptr ImageGroup::getNodeAtIndex(int index) const
@@ -167,9 +949,17 @@ void ImageGroup::onFileListLoadComplete()
 
   simplifyTree(tree_root_);
 
+  // from here on votes keep the tallies current through ImageDescriptionNode::setDecision()
+  recountDecisions(tree_root_);
+
   emit treeBuildComplete();
 }
 
+DecisionCounts ImageGroup::decisionCounts() const
+{
+  return tree_root_ ? tree_root_->decision_counts : DecisionCounts{};
+}
+
 void ImageGroup::adjustWorkLeft(int delta_work)
 {
   std::lock_guard lock(mutex_);
@@ -7,6 +7,8 @@
 #include <QModelIndex>
 #include <QPalette>
 #include <QVariant>
+#include <algorithm>
+#include <functional>
 
 #include "snapdecision/enums.h"
 #include "snapdecision/imagedescriptionnode.h"
@@ -193,6 +195,46 @@ void ImageTreeModel::setImageRoot(const ImageDescriptionNode::Ptr& root_node)
   recomputeCachedData();
 }
 
+void ImageTreeModel::replaceChildren(const ImageDescriptionNode::Ptr& parent, int row, int count,
+                                     const std::vector<ImageDescriptionNode::Ptr>& replacement)
+{
+  if (!isShown(parent.get()))
+  {
+    ::replaceChildren(parent, row, count, replacement);
+    return;
+  }
+
+  const QModelIndex parent_index = indexForNode(parent.get());
+
+  if (count > 0)
+  {
+    beginRemoveRows(parent_index, row, row + count - 1);
+    for (int i = row; i < row + count; i++)
+    {
+      forgetImages(parent->children[i].get());
+    }
+    ::replaceChildren(parent, row, count, {});
+    endRemoveRows();
+  }
+
+  if (!replacement.empty())
+  {
+    beginInsertRows(parent_index, row, row + static_cast<int>(replacement.size()) - 1);
+    ::replaceChildren(parent, row, 0, replacement);
+    for (const auto& child : replacement)
+    {
+      rememberImages(child.get());
+    }
+    endInsertRows();
+  }
+
+  // a location is labelled with the time of its first image
+  if (parent_index.isValid())
+  {
+    emit dataChanged(parent_index, parent_index);
+  }
+}
+
 ImageDescriptionNode* ImageTreeModel::nodeFromIndex(const QModelIndex& index) const
 {
   return nodeFromIndex(index, nullptr);
@@ -200,50 +242,102 @@ ImageDescriptionNode* ImageTreeModel::nodeFromIndex(const QModelIndex& index) co
 
 QModelIndex ImageTreeModel::indexForImage(const QString& imageName)
 {
-  if (index_for_image_.contains(imageName))
+  if (auto* node = node_for_image_.value(imageName, nullptr))
   {
-    return index_for_image_[imageName];
+    return indexForNode(node);
   }
   return QModelIndex();
 }
 
 QVector<QString> ImageTreeModel::getFileList() const
 {
-  return file_list_;
+  QVector<QString> file_list;
+
+  std::function<void(const ImageDescriptionNode*)> f;
+
+  f = [&f, &file_list](const ImageDescriptionNode* node)
+  {
+    for (const auto& child : node->children)
+    {
+      if (!child->full_path.empty())
+      {
+        file_list.push_back(QString::fromStdString(child->full_path));
+      }
+      f(child.get());
+    }
+  };
+
+  if (root_)
+  {
+    f(root_.get());
+  }
+  return file_list;
 }
 
 void ImageTreeModel::recomputeCachedData()
 {
-  file_list_.clear();
-  index_for_image_.clear();
+  node_for_image_.clear();
+
+  if (root_)
+  {
+    rememberImages(root_.get());
+  }
+}
+
+void ImageTreeModel::rememberImages(ImageDescriptionNode* node)
+{
+  if (!node->full_path.empty())
+  {
+    node_for_image_[QString::fromStdString(node->full_path)] = node;
+  }
 
-  std::function<void(const QModelIndex& parent)> f;
+  for (const auto& child : node->children)
+  {
+    rememberImages(child.get());
+  }
+}
 
-  f = [&f, this](const QModelIndex& parent)
+void ImageTreeModel::forgetImages(ImageDescriptionNode* node)
+{
+  // a changed image's new node may have been remembered already, that entry stays
+  if (const auto path = QString::fromStdString(node->full_path);
+      !path.isEmpty() && node_for_image_.value(path, nullptr) == node)
   {
-    const int rc = rowCount(parent);
-    for (int row = 0; row < rc; ++row)
-    {
-      const QModelIndex idx = index(row, 0, parent);
+    node_for_image_.remove(path);
+  }
 
-      auto node = nodeFromIndex(idx, root_.get());
+  for (const auto& child : node->children)
+  {
+    forgetImages(child.get());
+  }
+}
 
-      if (node && !node->full_path.empty())
-      {
-        const auto fn = QString::fromStdString(node->full_path);
+QModelIndex ImageTreeModel::indexForNode(ImageDescriptionNode* node) const
+{
+  const auto parent_node = node->parent.lock();
+  if (!parent_node || node == root_.get())
+  {
+    return QModelIndex();
+  }
 
-        file_list_.push_back(fn);
-        index_for_image_[fn] = idx;
-      }
+  const auto& siblings = parent_node->children;
+  const auto it =
+      std::find_if(siblings.begin(), siblings.end(), [node](const auto& sibling) { return sibling.get() == node; });
+  if (it == siblings.end())
+  {
+    return QModelIndex();
+  }
 
-      if (hasChildren(idx))
-      {
-        f(idx);
-      }
-    }
-  };
+  return createIndex(static_cast<int>(std::distance(siblings.begin(), it)), 0, node);
+}
 
-  f(QModelIndex());
+bool ImageTreeModel::isShown(ImageDescriptionNode* node) const
+{
+  while (node && node != root_.get())
+  {
+    node = node->parent.lock().get();
+  }
+  return node && node == root_.get();
 }
 
 ImageDescriptionNode* ImageTreeModel::nodeFromIndex(const QModelIndex& index, ImageDescriptionNode* fallback) const
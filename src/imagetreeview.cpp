@@ -1,5 +1,8 @@
 #include "snapdecision/imagetreeview.h"
 
+#include <set>
+#include <utility>
+
 #include "snapdecision/imagedescriptionnode.h"
 #include "snapdecision/imagetreemodel.h"
 
@@ -15,32 +18,95 @@ void ImageTreeView::updateHides()
   }
 }
 
-void ImageTreeView::iterateChildHide(const QModelIndex& parent, ImageTreeModel* model)
+void ImageTreeView::showArrivedRows()
 {
-  const auto node_visible = [this](ImageDescriptionNode* n) -> bool { return isVisible(n->decision); };
+  auto* image_model = dynamic_cast<ImageTreeModel*>(model());
+  const auto arrived_rows = std::exchange(arrived_rows_, {});
+  if (!image_model)
+  {
+    return;
+  }
+
+  std::set<QModelIndex> ancestors;
+  for (const QPersistentModelIndex& arrived : arrived_rows)
+  {
+    // gone again, or the tree was reset since
+    if (!arrived.isValid())
+    {
+      continue;
+    }
+
+    const QModelIndex index = arrived;
+    expandRecursively(index);
+    updateHide(index, image_model);
+
+    for (QModelIndex parent = index.parent(); parent.isValid() && ancestors.insert(parent).second;
+         parent = parent.parent())
+    {
+    }
+  }
+
+  // the counts above the new rows changed with them
+  for (const QModelIndex& ancestor : ancestors)
+  {
+    setRowHidden(ancestor.row(), ancestor.parent(), !rowVisible(ancestor, image_model));
+  }
+}
+
+void ImageTreeView::rowsInserted(const QModelIndex& parent, int start, int end)
+{
+  QTreeView::rowsInserted(parent, start, end);
+
+  for (int row = start; row <= end; ++row)
+  {
+    arrived_rows_.emplace_back(model()->index(row, 0, parent));
+  }
+}
 
+void ImageTreeView::iterateChildHide(const QModelIndex& parent, ImageTreeModel* model)
+{
   int rowCount = model->rowCount(parent);
 
   for (int row = 0; row < rowCount; ++row)
   {
-    QModelIndex currentIndex = model->index(row, 0, parent);
+    updateHide(model->index(row, 0, parent), model);
+  }
+}
 
-    bool visible = true;
-    if (auto* node = model->nodeFromIndex(currentIndex))
-    {
-      if (const auto c = node->leafConsensus(node_visible); c.has_value())
-      {
-        visible = c.value();
-      }
-    }
+void ImageTreeView::updateHide(const QModelIndex& index, ImageTreeModel* model)
+{
+  setRowHidden(index.row(), index.parent(), !rowVisible(index, model));
 
-    setRowHidden(row, parent, !visible);
+  if (model->hasChildren(index))
+  {
+    iterateChildHide(index, model);
+  }
+}
 
-    if (model->hasChildren(currentIndex))
+bool ImageTreeView::rowVisible(const QModelIndex& index, ImageTreeModel* model) const
+{
+  auto* node = model->nodeFromIndex(index);
+  if (!node)
+  {
+    return true;
+  }
+
+  // a row is hidden once every image below it has a hidden decision
+  const auto& counts = node->decision_counts;
+  if (counts.total() == 0)
+  {
+    return true;
+  }
+
+  int shown = 0;
+  for (std::size_t d = 0; d < counts.counts.size(); d++)
+  {
+    if (isVisible(static_cast<DecisionType>(d)))
     {
-      iterateChildHide(currentIndex, model);
+      shown += counts.counts[d];
     }
   }
+  return shown > 0;
 }
 
 QModelIndex ImageTreeView::getLastIndex() const
@@ -1,70 +1,264 @@
 #include "snapdecision/libjpegturbo_loader.h"
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 extern "C"
 {
 #include <turbojpeg.h>
 }
 #include <QDebug>
+#include <QFile>
 #include <QImage>
 
-static QImage loadJpegWithLibjpegTurbo(const QString& filename)
+namespace
 {
-  tjhandle decompressor = tjInitDecompress();
-  if (!decompressor)
+// One decompressor per thread, created on first use and kept for the life of the thread.
+struct Decompressor
+{
+  tjhandle handle{ tjInitDecompress() };
+
+  ~Decompressor()
   {
-    throw std::runtime_error("Failed to initialize TurboJPEG decompressor");
+    if (handle)
+    {
+      tjDestroy(handle);
+    }
   }
+};
 
-  FILE* jpegFile = fopen(filename.toStdString().c_str(), "rb");
-  if (!jpegFile)
+tjhandle threadDecompressor()
+{
+  thread_local Decompressor decompressor;
+  return decompressor.handle;
+}
+
+// Decoded pixel buffers are recycled instead of going back to the allocator.
+// A QImage wraps the buffer without copying and hands it back here once the
+// last copy of the image is gone. The idle buffers are capped in bytes, they
+// count against no tier of the cache.
+class BufferPool
+{
+public:
+  struct Buffer
   {
-    tjDestroy(decompressor);
-    throw std::runtime_error("Failed to open JPEG file");
+    std::unique_ptr<unsigned char[]> data;
+    std::size_t capacity{ 0 };
+  };
+
+  static BufferPool& instance()
+  {
+    static BufferPool pool;
+    return pool;
   }
 
-  fseek(jpegFile, 0, SEEK_END);
-  long size = ftell(jpegFile);
-  fseek(jpegFile, 0, SEEK_SET);
+  Buffer* acquire(std::size_t bytes)
+  {
+    {
+      std::lock_guard lock(mutex_);
+
+      // don't hand out a buffer that wastes more than half of itself
+      const auto it = std::find_if(free_.begin(), free_.end(), [bytes](const std::unique_ptr<Buffer>& b)
+                                   { return b->capacity >= bytes && b->capacity / 2 <= bytes; });
+      if (it != free_.end())
+      {
+        Buffer* buffer = it->release();
+        free_.erase(it);
+        free_bytes_ -= buffer->capacity;
+        return buffer;
+      }
+    }
 
-  unsigned char* jpegBuffer = reinterpret_cast<unsigned char*>(tjAlloc(size));
-  if (fread(jpegBuffer, 1, size, jpegFile) < size)
+    auto* buffer = new Buffer;
+    buffer->data = std::make_unique<unsigned char[]>(bytes);
+    buffer->capacity = bytes;
+    return buffer;
+  }
+
+  void release(Buffer* buffer)
   {
-    tjFree(jpegBuffer);
-    fclose(jpegFile);
-    tjDestroy(decompressor);
-    throw std::runtime_error("Failed to read JPEG file");
+    std::lock_guard lock(mutex_);
+
+    if (buffer->capacity > max_free_bytes_)
+    {
+      delete buffer;
+      return;
+    }
+
+    shrinkTo(max_free_bytes_ - buffer->capacity);
+    free_.emplace_back(buffer);
+    free_bytes_ += buffer->capacity;
   }
 
-  fclose(jpegFile);
+  void setLimit(std::size_t max_free_bytes)
+  {
+    std::lock_guard lock(mutex_);
+
+    max_free_bytes_ = max_free_bytes;
+    shrinkTo(max_free_bytes_);
+  }
+
+  static void cleanup(void* info)
+  {
+    instance().release(static_cast<Buffer*>(info));
+  }
+
+private:
+  // drops the oldest buffers, mutex_ held
+  void shrinkTo(std::size_t bytes)
+  {
+    while (free_bytes_ > bytes)
+    {
+      free_bytes_ -= free_.front()->capacity;
+      free_.erase(free_.begin());
+    }
+  }
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Buffer>> free_;
+  std::size_t free_bytes_{ 0 };
+  std::size_t max_free_bytes_{ 0 };  // nothing is kept until an image cache sets the limit
+};
+}  // namespace
+
+void libjpegturboSetBufferPoolLimit(std::size_t bytes)
+{
+  BufferPool::instance().setLimit(bytes);
+}
+
+// libjpeg-turbo fills the X byte with 0xff, which is exactly what Format_RGB32 expects
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+static constexpr int rgb32_pixel_format = TJPF_BGRX;
+#else
+static constexpr int rgb32_pixel_format = TJPF_XRGB;
+#endif
+
+// Smallest of the scaling factors libjpeg-turbo supports natively (1/8, 1/4, 1/2, ...)
+// that still covers target once the aspect ratio is kept. Scaling happens in the
+// DCT domain, so a smaller factor skips most of the decode work.
+static tjscalingfactor pickScalingFactor(int width, int height, const QSize& target)
+{
+  tjscalingfactor best{ 1, 1 };
+
+  if (!target.isValid() || (width <= target.width() && height <= target.height()))
+  {
+    return best;
+  }
+
+  const QSize fit = QSize(width, height).scaled(target, Qt::KeepAspectRatio);
+
+  int count = 0;
+  const tjscalingfactor* factors = tjGetScalingFactors(&count);
+  if (!factors)
+  {
+    return best;
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    const tjscalingfactor& f = factors[i];
+    if (f.num > f.denom)
+    {
+      continue;
+    }
+
+    const int scaled_width = TJSCALED(width, f);
+    const int scaled_height = TJSCALED(height, f);
+
+    if (scaled_width >= fit.width() && scaled_height >= fit.height() && scaled_width < TJSCALED(width, best))
+    {
+      best = f;
+    }
+  }
+
+  return best;
+}
+
+static QImage decodeJpegWithLibjpegTurbo(const unsigned char* jpegBuffer, unsigned long size, const QSize& target,
+                                         QSize* full_size)
+{
+  tjhandle decompressor = threadDecompressor();
+  if (!decompressor)
+  {
+    throw std::runtime_error("Failed to initialize TurboJPEG decompressor");
+  }
 
   int width, height;
   if (tjDecompressHeader(decompressor, jpegBuffer, size, &width, &height) < 0)
   {
-    tjFree(jpegBuffer);
-    tjDestroy(decompressor);
     throw std::runtime_error("Failed to read JPEG header");
   }
 
-  QImage image(width, height, QImage::Format_RGB888);
-  if (tjDecompress2(decompressor, jpegBuffer, size, image.bits(), width, image.bytesPerLine(), height, TJPF_RGB, 0) < 0)
+  if (full_size)
+  {
+    *full_size = QSize(width, height);
+  }
+
+  const tjscalingfactor factor = pickScalingFactor(width, height, target);
+  const int scaled_width = TJSCALED(width, factor);
+  const int scaled_height = TJSCALED(height, factor);
+
+  // decode straight into the layout of Format_RGB32 (0xffRRGGBB per pixel) so nothing converts it later
+  const int bytes_per_line = scaled_width * 4;
+  const std::size_t bytes = static_cast<std::size_t>(bytes_per_line) * scaled_height;
+
+  BufferPool::Buffer* buffer = BufferPool::instance().acquire(bytes);
+
+  if (tjDecompress2(decompressor, jpegBuffer, size, buffer->data.get(), scaled_width, bytes_per_line, scaled_height,
+                    rgb32_pixel_format, 0) < 0)
   {
-    tjFree(jpegBuffer);
-    tjDestroy(decompressor);
+    BufferPool::instance().release(buffer);
     throw std::runtime_error("Failed to decompress JPEG");
   }
 
-  tjFree(jpegBuffer);
-  tjDestroy(decompressor);
+  return QImage(buffer->data.get(), scaled_width, scaled_height, bytes_per_line, QImage::Format_RGB32,
+                &BufferPool::cleanup, buffer);
+}
+
+static QImage loadJpegWithLibjpegTurbo(const QString& filename, qint64 offset, qint64 length, const QSize& target,
+                                       QSize* full_size)
+{
+  // the compressed data is read straight out of the page cache, the mapping goes away with jpeg_file
+  QFile jpeg_file(filename);
+  if (!jpeg_file.open(QIODevice::ReadOnly))
+  {
+    throw std::runtime_error("Failed to open JPEG file");
+  }
+
+  const qint64 size = length > 0 ? length : jpeg_file.size() - offset;
+  if (size <= 0 || offset + size > jpeg_file.size())
+  {
+    throw std::runtime_error("JPEG data is outside of the file");
+  }
+
+  const unsigned char* jpegBuffer = jpeg_file.map(offset, size);
+  if (!jpegBuffer)
+  {
+    throw std::runtime_error("Failed to map JPEG file");
+  }
+
+  return decodeJpegWithLibjpegTurbo(jpegBuffer, static_cast<unsigned long>(size), target, full_size);
+}
 
-  return image;
+QImage libjpegturboOpen(const QString& filename, QSize target, QSize* full_size)
+{
+  try
+  {
+    return loadJpegWithLibjpegTurbo(filename, 0, 0, target, full_size);
+  }
+  catch (const std::runtime_error&)
+  {
+    return QImage();
+  }
 }
 
-QImage libjpegturboOpen(const QString& filename)
+QImage libjpegturboOpenEmbedded(const QString& filename, qint64 offset, qint64 length, QSize target)
 {
   try
   {
-    return loadJpegWithLibjpegTurbo(filename);
+    return loadJpegWithLibjpegTurbo(filename, offset, length, target, nullptr);
   }
   catch (const std::runtime_error&)
   {
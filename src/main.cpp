@@ -43,6 +43,11 @@ void loadSettings(Settings& s)
 
   s.show_debug_console_ = q.value("show_debug_console", d.show_debug_console_).toBool();
 
+  s.prefetch_max_ahead_ = q.value("prefetch_max_ahead", d.prefetch_max_ahead_).toULongLong();
+  s.prefetch_behind_ = q.value("prefetch_behind", d.prefetch_behind_).toULongLong();
+
+  s.catalog_database_path_ = q.value("catalog_database_path", d.catalog_database_path_).toString();
+
   const auto key = [&](const auto& k, auto member)
   { s.*member = QKeySequence{ q.value(k, (d.*member).toString()).toString() }; };
 
@@ -92,6 +97,9 @@ void storeSettings(const Settings& s)
   q.setValue("delete_folder_name", s.delete_foler_name_);
   q.setValue("cache_memory_mb", s.cache_memory_mb_);
   q.setValue("show_debug_console", s.show_debug_console_);
+  q.setValue("prefetch_max_ahead", s.prefetch_max_ahead_);
+  q.setValue("prefetch_behind", s.prefetch_behind_);
+  q.setValue("catalog_database_path", s.catalog_database_path_);
 
   const auto key = [&](const auto& k, auto member) { q.setValue(k, (s.*member).toString()); };
 
@@ -1,15 +1,20 @@
 #include "snapdecision/maincontroller.h"
 
 #include <QByteArray>
+#include <QClipboard>
 #include <QFile>
 #include <QFileInfo>
+#include <QGuiApplication>
 #include <QImageReader>
 #include <QObject>
+#include <QScreen>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <QImageReader>
 #include <QStringList>
 
@@ -19,6 +24,11 @@
 #include "snapdecision/utils.h"
 #include "ui_mainwindow.h"
 
+// Background load priorities: prefetching goes ahead of the queued ingest work (priority 0),
+// and whatever is on screen goes ahead of prefetching.
+static constexpr int prefetch_priority = 1;
+static constexpr int on_screen_priority = 2;
+
 MainController::MainController(MainModel* model, MainWindow* view, Settings* settings)
   : QObject(), model_(model), view_(view), settings_(settings)
 {
@@ -28,6 +38,16 @@ MainController::MainController(MainModel* model, MainWindow* view, Settings* set
   view->get_settings_ = [this]() { return *settings_; };
 
   model_->image_group_->get_settings_ = [this]() { return *settings_; };
+  model_->image_group_->replace_children_ =
+      [this](const ImageDescriptionNode::Ptr& parent, int row, int count,
+             const std::vector<ImageDescriptionNode::Ptr>& replacement)
+  { model_->image_tree_model_->replaceChildren(parent, row, count, replacement); };
+
+  // the culling view never needs more pixels than the screen has
+  if (const QScreen* screen = QGuiApplication::primaryScreen())
+  {
+    model_->image_cache_->setTierSize(ImageTier::Screen, screen->size() * screen->devicePixelRatio());
+  }
 
   view->ui->treeView->setModel(model->image_tree_model_.get());
 
@@ -69,6 +89,40 @@ void MainController::treeBuildComplete()
   updateDecisionCounts();
 }
 
+void MainController::treeCleared()
+{
+  model_->image_tree_model_->setImageRoot(model_->image_group_->tree_root_);
+
+  current_image_full_path_.clear();
+  previous_focus_index_ = -1;
+  current_focus_index_ = -1;
+
+  const QFileInfo file_info(resource_);
+  pending_focus_ = file_info.isFile() ? file_info.absoluteFilePath() : QString();
+
+  updateDecisionCounts();
+}
+
+void MainController::treeUpdated()
+{
+  const auto& image_group = model_->image_group_;
+
+  // only what was just streamed in, the rest of the tree is as it was
+  view_->ui->treeView->showArrivedRows();
+
+  // the image asked for once it is in, until then whichever arrived first so culling can start
+  if (!pending_focus_.isEmpty() && image_group->lookup(pending_focus_.toStdString()))
+  {
+    focusOnNode(std::exchange(pending_focus_, QString()));
+  }
+  else if (current_image_full_path_.isEmpty() && !image_group->flat_list_.empty())
+  {
+    focusOnNode(QString::fromStdString(image_group->flat_list_.front()->full_path));
+  }
+
+  updateDecisionCounts();
+}
+
 QStringList getImageFileExtensions()
 {
   QStringList extensions;
@@ -107,17 +161,8 @@ void MainController::loadResource(const QString& path)
   QSettings settings("JasonIMercer", "SnapDecision");
   settings.setValue("lastLoadResource", path);
 
-  std::vector<std::string> image_filenames;
-
-  QStringList files = directory.entryList(getImageFileExtensions());
-
-  for (const QString& file : files)
-  {
-    image_filenames.push_back(directory.absoluteFilePath(file).toStdString());
-  }
-
-  model_->image_group_->loadFiles(image_filenames, model_->image_cache_, model_->task_queue_, model_->database_manager_,
-                                  model_->diagnostic_function_);
+  model_->image_group_->loadFolder(directory.absolutePath(), getImageFileExtensions(), model_->image_cache_,
+                                   model_->task_queue_, model_->database_manager_, model_->diagnostic_function_);
 }
 
 void MainController::setupConnections()
@@ -128,9 +173,24 @@ void MainController::setupConnections()
   connect(view_->ui->action_Quit, &QAction::triggered, this, []() { QCoreApplication::quit(); });
 
   connect(model_->image_group_.get(), SIGNAL(treeBuildComplete()), this, SLOT(treeBuildComplete()));
+  connect(model_->image_group_.get(), SIGNAL(treeCleared()), this, SLOT(treeCleared()));
+  connect(model_->image_group_.get(), SIGNAL(treeUpdated()), this, SLOT(treeUpdated()));
+  connect(model_->image_group_.get(), &ImageGroup::fileListLoadComplete, this, [this]() {
+    view_->statusBar()->showMessage(
+        QString("Loaded %1 images").arg(static_cast<int>(model_->image_group_->flat_list_.size())), 2000);
+  });
+  connect(model_->image_group_.get(), &ImageGroup::databaseOpenProgress, this, [this](double fraction) {
+    view_->statusBar()->showMessage(QString("Opening image database %1%").arg(static_cast<int>(fraction * 100)), 2000);
+  });
 
   connect(&model_->image_cache_->signal_emitter, SIGNAL(memoryUsageChanged(CurrentMaxCount)), this,
           SLOT(memoryUsageChanged(CurrentMaxCount)));
+  connect(&model_->image_cache_->signal_emitter, SIGNAL(hitMissUpdate(CountPair)), this,
+          SLOT(hitMissUpdate(CountPair)));
+  connect(&model_->image_cache_->signal_emitter, SIGNAL(imageLoaded(QString, int)), this,
+          SLOT(imageLoaded(QString, int)));
+  connect(view_->ui->graphicsView, &SnapDecisionGraphicsView::fullResolutionNeeded, this,
+          &MainController::fullResolutionNeeded);
 
   auto key_func = [this](QKeyEvent* event) { return this->keyPressed(event); };
 
@@ -139,6 +199,7 @@ void MainController::setupConnections()
   connect(view_->ui->actionTool3, &QAction::triggered, this, [this]() { executeTool(2); });
   connect(view_->ui->actionTool4, &QAction::triggered, this, [this]() { executeTool(3); });
   connect(view_->ui->actionRemove_All_Decisions, &QAction::triggered, this, [this]() { removeAllDecisions(); });
+  connect(view_->ui->actionCopy_Gold_Paths, &QAction::triggered, this, [this]() { copyGoldPaths(); });
 
   connect(view_->ui->category_display, &CategoryDisplayWidget::activeChange, this,
           [this](DecisionType d, bool visible) { view_->ui->treeView->setDecisionVisible(d, visible); });
@@ -231,11 +292,57 @@ void MainController::focusOnNode(const QString& image_name)
   }
   current_image_full_path_ = image_name;
 
+  // What was asked for the image we leave is only given up once the new requests are in, so a load
+  // still wanted, e.g. for prefetching, carries on.
+  const auto leaving = std::exchange(on_screen_loads_, {});
+
   auto node = model->nodeFromIndex(index);
   if (node)
   {
-    view_->ui->graphicsView->setImage(node->image_cache_handle_->blockingImage(), image_name.toStdString(),
-                                      node->orientation);
+    const auto& handle = node->image_cache_handle_;
+    auto* graphics_view = view_->ui->graphicsView;
+
+    // a screen sized image is all fit-to-view culling needs, full resolution follows when zooming in
+    displayed_tier_ = ImageTier::Full;
+    QImage img = handle->image(ImageTier::Full);
+    if (img.isNull())
+    {
+      displayed_tier_ = ImageTier::Screen;
+      img = handle->image(ImageTier::Screen);
+    }
+
+    const bool ready = !img.isNull();
+    model_->image_cache_->updateHitMiss(ready ? 1 : 0, ready ? 0 : 1);
+
+    // Not decoded yet. Nothing here may decode a whole file on the GUI thread, the embedded thumbnail is
+    // shown right away only when it is already in memory or cheap to read; imageLoaded swaps in the rest.
+    if (img.isNull())
+    {
+      displayed_tier_ = ImageTier::Thumbnail;
+      img = handle->image(ImageTier::Thumbnail);
+      if (img.isNull() && handle->hasEmbeddedPreview())
+      {
+        img = handle->blockingImage(ImageTier::Thumbnail);
+      }
+      if (img.isNull())
+      {
+        displayed_tier_.reset();
+        requestLoad(on_screen_loads_, handle, on_screen_priority, ImageTier::Thumbnail);
+      }
+      requestLoad(on_screen_loads_, handle, on_screen_priority, ImageTier::Screen);
+    }
+
+    // the cache holds QImages, uploading to a pixmap has to happen here on the GUI thread
+    if (!img.isNull())
+    {
+      graphics_view->setImage(QPixmap::fromImage(img), image_name.toStdString(), node->orientation,
+                              handle->fullSize());
+    }
+
+    if (displayed_tier_ != ImageTier::Full && graphics_view->isZoomedPastFit())
+    {
+      fullResolutionNeeded();
+    }
 
     view_->ui->graphicsView->showDecision(node->decision);
 
@@ -292,13 +399,161 @@ void MainController::focusOnNode(const QString& image_name)
     previous_focus_index_ = current_focus_index_;
     current_focus_index_ = current.value();
 
-    const auto probably_next = predictNextNode(1);
+    updateNavigationRate();
+
+    const int direction = predictNextNode(1) > current_focus_index_ ? 1 : -1;
+    const auto [ahead, behind] = prefetchWindow();
+    const auto current_handle = node ? node->image_cache_handle_ : nullptr;
+
+    // nearest first, the queue runs them in the order they were scheduled
+    std::vector<ImageCacheHandle::Ptr> wanted;
+    const auto want = [&](int index)
+    {
+      if (const auto n = image_group_->getNodeAtIndex(index); n && n->image_cache_handle_ &&
+                                                              n->image_cache_handle_ != current_handle &&
+                                                              std::find(wanted.begin(), wanted.end(),
+                                                                        n->image_cache_handle_) == wanted.end())
+      {
+        wanted.push_back(n->image_cache_handle_);
+      }
+    };
+
+    for (int i = 1; i <= std::max(ahead, behind); ++i)
+    {
+      if (i <= ahead)
+      {
+        want(current_focus_index_ + direction * i);
+      }
+      if (i <= behind)
+      {
+        want(current_focus_index_ - direction * i);
+      }
+    }
+
+    prefetch(wanted);
+  }
+
+  withdrawLoads(leaving);
+}
+
+void MainController::updateNavigationRate()
+{
+  // anything slower than this is looking at the image, not flipping through them
+  static constexpr double max_interval_ms = 2000;
+
+  if (!navigation_timer_.isValid())
+  {
+    navigation_timer_.start();
+    return;
+  }
+
+  const double elapsed = std::min<double>(static_cast<double>(navigation_timer_.restart()), max_interval_ms);
+  navigation_interval_ms_ = navigation_interval_ms_ > 0 ? 0.75 * navigation_interval_ms_ + 0.25 * elapsed : elapsed;
+}
 
-    if (const auto next_node = image_group_->getNodeAtIndex(probably_next); next_node)
+std::pair<int, int> MainController::prefetchWindow() const
+{
+  const auto& cache = model_->image_cache_;
+
+  const int max_ahead = std::max(1, static_cast<int>(settings_->prefetch_max_ahead_));
+  int behind = static_cast<int>(settings_->prefetch_behind_);
+  int ahead = 1;
+
+  // keep enough decodes in flight that each one finishes before we arrive at it
+  const double decode_ms = static_cast<double>(cache->averageDecodeTimeUs(ImageTier::Screen)) / 1000.0;
+  if (navigation_interval_ms_ > 0 && decode_ms > 0)
+  {
+    ahead = static_cast<int>(std::ceil(decode_ms / navigation_interval_ms_)) + 1;
+  }
+
+  // prefetching more than the screen tier holds would only evict what we prefetched earlier
+  const auto [used, max, count] = cache->getMemoryUsage(ImageTier::Screen);
+  if (count > 0 && used > 0)
+  {
+    const int fits = static_cast<int>(max / (used / count)) - 1;  // one slot for the image on screen
+    behind = std::clamp(behind, 0, std::max(0, fits - 1));
+    ahead = std::min(ahead, std::max(1, fits - behind));
+  }
+
+  // no point wrapping around onto images already in the window
+  const int image_count = static_cast<int>(model_->image_group_->flat_list_.size());
+  ahead = std::clamp(ahead, 1, std::max(1, std::min(max_ahead, image_count - 1)));
+  behind = std::clamp(behind, 0, std::max(0, image_count - 1 - ahead));
+
+  return { ahead, behind };
+}
+
+void MainController::prefetch(const std::vector<ImageCacheHandle::Ptr>& wanted)
+{
+  // asking again before taking the old requests back keeps the loads still wanted going
+  const auto previous = std::exchange(prefetch_loads_, {});
+
+  for (const auto& handle : wanted)
+  {
+    if (handle)
     {
-      next_node->image_cache_handle_->scheduleImage();
+      requestLoad(prefetch_loads_, handle, prefetch_priority, ImageTier::Screen);
     }
   }
+
+  // anything we asked for earlier that is no longer wanted is only wasting decode time
+  withdrawLoads(previous);
+}
+
+void MainController::requestLoad(std::vector<OwnedLoad>& owned, const ImageCacheHandle::Ptr& handle, int priority,
+                                 ImageTier tier)
+{
+  if (auto load = handle->scheduleImage(priority, tier))
+  {
+    owned.push_back({ handle, tier, std::move(load) });
+  }
+}
+
+void MainController::withdrawLoads(const std::vector<OwnedLoad>& owned)
+{
+  for (const auto& [handle, tier, load] : owned)
+  {
+    handle->withdraw(tier, load);
+  }
+}
+
+void MainController::fullResolutionNeeded()
+{
+  // zooming asks again with every step, one request is enough
+  const auto requested = [](const OwnedLoad& owned) { return owned.tier == ImageTier::Full; };
+  if (displayed_tier_ == ImageTier::Full || std::any_of(on_screen_loads_.begin(), on_screen_loads_.end(), requested))
+  {
+    return;
+  }
+
+  if (const auto node = currentNode(); node && node->image_cache_handle_)
+  {
+    requestLoad(on_screen_loads_, node->image_cache_handle_, on_screen_priority, ImageTier::Full);
+  }
+}
+
+void MainController::imageLoaded(const QString& image_path, int tier)
+{
+  const auto loaded_tier = static_cast<ImageTier>(tier);
+
+  if (image_path != current_image_full_path_ || (displayed_tier_ && loaded_tier <= *displayed_tier_))
+  {
+    return;
+  }
+
+  const auto node = currentNode();
+  if (!node || !node->image_cache_handle_)
+  {
+    return;
+  }
+
+  const auto& handle = node->image_cache_handle_;
+  if (const QImage img = handle->image(loaded_tier); !img.isNull())
+  {
+    displayed_tier_ = loaded_tier;
+    view_->ui->graphicsView->setImage(QPixmap::fromImage(img), image_path.toStdString(), node->orientation,
+                                      handle->fullSize());
+  }
 }
 
 void MainController::memoryUsageChanged(CurrentMaxCount cmc)
@@ -310,12 +565,33 @@ void MainController::memoryUsageChanged(CurrentMaxCount cmc)
     used /= 1000000;
     max /= 1000000;
 
-    auto msg = QString("Image Cache: %3 images (%1 MB / %2 MB)").arg(used).arg(max).arg(count);
+    const auto coalesced = model_->image_cache_->coalescedLoadCount();
+
+    const auto& [hits, misses] = ready_count_;
+    const auto visited = hits + misses;
+    const auto ready_percent = visited ? (100 * hits) / visited : 0;
+
+    const auto [ahead, behind] = prefetchWindow();
+
+    auto msg = QString("Image Cache: %3 images (%1 MB / %2 MB), %4 duplicate loads avoided, "
+                       "%5% ready on arrival, prefetching %6 ahead / %7 behind")
+                   .arg(used)
+                   .arg(max)
+                   .arg(count)
+                   .arg(coalesced)
+                   .arg(ready_percent)
+                   .arg(ahead)
+                   .arg(behind);
 
     view_->statusBar()->showMessage(msg, 5000);
   }
 }
 
+void MainController::hitMissUpdate(CountPair cp)
+{
+  ready_count_ = cp;
+}
+
 bool MainController::keyPressed(QKeyEvent* event)
 {
   if (!event)
@@ -505,12 +781,12 @@ void MainController::setSettings(const Settings& s)
 
 void MainController::updateDecisionCounts()
 {
-  const auto counts = model_->database_manager_->getDecisionCounts();
+  const auto counts = model_->image_group_->decisionCounts();
 
-  const int delete_count = static_cast<int>(counts[1]);
-  const int unclassified_count = static_cast<int>(counts[2] + counts[0]);
-  const int keep_count = static_cast<int>(counts[3]);
-  const int superkeep_count = static_cast<int>(counts[4]);
+  const int delete_count = counts[DecisionType::Delete];
+  const int unclassified_count = counts[DecisionType::Unclassified] + counts[DecisionType::Unknown];
+  const int keep_count = counts[DecisionType::Keep];
+  const int superkeep_count = counts[DecisionType::SuperKeep];
 
   view_->ui->category_display->setCounts(delete_count, unclassified_count, keep_count, superkeep_count);
 }
@@ -655,10 +931,9 @@ void MainController::removeAllDecisions()
 {
   for (auto& ptr : model_->image_group_->flat_list_)
   {
-    if (ptr->decision != DecisionType::Unclassified)
+    if (ptr->setDecision(DecisionType::Unclassified))
     {
-      ptr->decision = DecisionType::Unclassified;
-      model_->database_manager_->setDecision(ptr->full_path, ptr->decision);
+      model_->database_manager_->queueDecision(ptr->full_path, ptr->decision);
     }
   }
   view_->ui->treeView->doItemsLayout();
@@ -670,6 +945,21 @@ void MainController::removeAllDecisions()
   }
 }
 
+void MainController::copyGoldPaths()
+{
+  // with a catalog these are the gold images of every folder ever opened, not only the one shown
+  const auto paths = model_->database_manager_->findImages({ .decision = DecisionType::SuperKeep });
+
+  QStringList lines;
+  for (const auto& path : paths)
+  {
+    lines << QString::fromStdString(path);
+  }
+
+  QGuiApplication::clipboard()->setText(lines.join("\n"));
+  view_->statusBar()->showMessage(QString("Copied the paths of %1 gold images").arg(lines.size()), 5000);
+}
+
 ImageDescriptionNode::Ptr MainController::currentNode()
 {
   return model_->image_group_->getNodeAtIndex(current_focus_index_);
@@ -690,9 +980,9 @@ void MainController::voteAdjust(const ImageDescriptionNode::Ptr& ptr, int direct
 {
   if (ptr)
   {
-    if (decisionShift(ptr->decision, direction))
+    if (DecisionType shifted = ptr->decision; decisionShift(shifted, direction) && ptr->setDecision(shifted))
     {
-      model_->database_manager_->setDecision(ptr->full_path, ptr->decision);
+      model_->database_manager_->queueDecision(ptr->full_path, ptr->decision);
       view_->ui->graphicsView->setDecision(ptr->decision);
       view_->ui->treeView->doItemsLayout();
       updateDecisionCounts();
@@ -704,9 +994,9 @@ void MainController::voteSet(const ImageDescriptionNode::Ptr& ptr, DecisionType
 {
   if (ptr)
   {
-    if (std::exchange(ptr->decision, decision) != decision)
+    if (ptr->setDecision(decision))
     {
-      model_->database_manager_->setDecision(ptr->full_path, ptr->decision);
+      model_->database_manager_->queueDecision(ptr->full_path, ptr->decision);
       view_->ui->graphicsView->setDecision(ptr->decision);
       view_->ui->treeView->doItemsLayout();
       updateDecisionCounts();
@@ -24,6 +24,7 @@ void ProgramSettings::setSettings(const Settings& s)
   ui->txtDeleteFolderName->setText(s.delete_foler_name_);
   ui->spinCache->setValue(s.cache_memory_mb_);
   ui->checkConsole->setChecked(s.show_debug_console_);
+  ui->txtCatalogDatabase->setText(s.catalog_database_path_);
 
   const auto f = [&](auto* key, const auto& seq) { key->setKeySequence(seq); };
 
@@ -88,6 +89,7 @@ Settings ProgramSettings::getSettings() const
   }
   s.cache_memory_mb_ = ui->spinCache->value();
   s.show_debug_console_ = ui->checkConsole->isChecked();
+  s.catalog_database_path_ = ui->txtCatalogDatabase->text().trimmed();
   s.key_next_image_ = ui->keyNextImage->keySequence();
 
   const auto f = [&](const auto* key, auto& seq) { seq = key->keySequence(); };
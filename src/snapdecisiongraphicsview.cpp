@@ -21,7 +21,8 @@ SnapDecisionGraphicsView::~SnapDecisionGraphicsView()
 {
 }
 
-void SnapDecisionGraphicsView::setImage(const QPixmap& pixmap, const std::string& filename, int orientation)
+void SnapDecisionGraphicsView::setImage(const QPixmap& pixmap, const std::string& filename, int orientation,
+                                        QSize full_size)
 {
   if (pixmap.isNull())
   {
@@ -44,6 +45,7 @@ void SnapDecisionGraphicsView::setImage(const QPixmap& pixmap, const std::string
   pix_item_->setPos(-item_center);
 
   pix_item_->setRotation(0);
+  pix_item_->setScale(full_size.isValid() ? static_cast<double>(full_size.width()) / pixmap.width() : 1.0);
 
   switch (orientation)
   {
@@ -143,6 +145,7 @@ void SnapDecisionGraphicsView::setViewLevel(int level)
   if (level > 1)
   {
     new_scale_factor *= std::pow(2.0, level - 1);
+    emit fullResolutionNeeded();
   }
 
   // Calculate the scale factor relative to the current scale
@@ -152,6 +155,11 @@ void SnapDecisionGraphicsView::setViewLevel(int level)
   restoreCenter();
 }
 
+bool SnapDecisionGraphicsView::isZoomedPastFit()
+{
+  return pix_item_ && transform().m11() > calculateBaseScaleFactor() * 1.01;
+}
+
 void SnapDecisionGraphicsView::externalZoomIn()
 {
   zoom(1.15);
@@ -231,6 +239,11 @@ void SnapDecisionGraphicsView::zoomAt(const QPointF& center_pos, double factor)
   setTransform(matrix);
 
   setTransformationAnchor(old_anchor);
+
+  if (isZoomedPastFit())
+  {
+    emit fullResolutionNeeded();
+  }
 }
 
 void SnapDecisionGraphicsView::zoom(double factor)